@@ -0,0 +1,65 @@
+#include <stdlib.h>
+
+#include "common.h"
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN      16
+
+struct ArenaChunk {
+    ArenaChunk *next;
+    /* keep data aligned for any object we hand out */
+    union {
+        long double ld;
+        void        *p;
+        char        c[ARENA_ALIGN];
+    } data[];
+};
+
+void
+arena_init(Arena *arena)
+{
+    arena->chunks = NULL;
+    arena->used   = 0;
+    arena->size   = 0;
+}
+
+void *
+arena_alloc(Arena *arena, size_t size)
+{
+    ArenaChunk *chunk;
+    void       *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (!arena->chunks || arena->used + size > arena->size) {
+        size_t chunk_size = size > ARENA_CHUNK_SIZE? size: ARENA_CHUNK_SIZE;
+
+        if (!(chunk = malloc(sizeof(ArenaChunk) + chunk_size)))
+            die("arena alloc err\n");
+
+        chunk->next   = arena->chunks;
+        arena->chunks = chunk;
+        arena->used   = 0;
+        arena->size   = chunk_size;
+    }
+
+    p = (char *)arena->chunks->data + arena->used;
+    arena->used += size;
+
+    return p;
+}
+
+void
+arena_release(Arena *arena)
+{
+    ArenaChunk *chunk = arena->chunks;
+
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    arena_init(arena);
+}
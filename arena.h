@@ -0,0 +1,16 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct {
+    ArenaChunk *chunks; /* newest chunk first       */
+    size_t     used;    /* bytes used in newest one */
+    size_t     size;    /* capacity of newest one   */
+} Arena;
+
+void arena_init(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);
+void arena_release(Arena *arena);
+
+#endif
@@ -0,0 +1,346 @@
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include "common.h"
+
+/*
+ * keystroke to frame latency of ice, run under a pty.
+ * ice wraps frames in synchronized output once the terminal says it
+ * knows mode 2026, so the bench answers that query and takes the end
+ * of the mode as the end of a frame. prints one json object per
+ * scenario and buffer size
+ */
+
+#define BENCH_ROWS       50
+#define BENCH_COLS       160
+#define BENCH_IDLE_MS    200   /* quiet time that ends startup output */
+#define BENCH_FRAME_MS   5000  /* a key without a frame by then is missed */
+
+#define SYNC_QUERY       "\x1b[?2026$p"
+#define SYNC_REPLY       "\x1b[?2026;2$y"
+#define SYNC_END         "\x1b[?2026l"
+#define SYNC_END_LEN     (sizeof(SYNC_END)-1)
+
+#define KEY_UP           "\x1b[A"
+#define KEY_DOWN         "\x1b[B"
+#define KEY_QUIT         "\x11"
+#define PASTE_BEGIN      "\x1b[200~"
+#define PASTE_END        "\x1b[201~"
+#define PASTE_LINES      50
+
+typedef struct {
+    int    fd;               /* pty master               */
+    pid_t  pid;
+    char   carry[16];        /* tail of the last read, a */
+    size_t ncarry;           /* marker may span reads    */
+} Term;
+
+typedef struct {
+    long long *lat;          /* per key latency, us      */
+    size_t    *bytes;        /* per key output bytes     */
+    size_t    n, cap;
+    size_t    missed;
+} Stats;
+
+typedef void (*Scenario)(Term *t, Stats *st);
+
+static char g_home[] = "/tmp/ice_bench.XXXXXX";
+
+/* start ice on a new pty with HOME in the scratch dir */
+static void
+term_start(Term *t, const char *ice, const char *file)
+{
+    struct winsize ws = { BENCH_ROWS, BENCH_COLS, 0, 0 };
+    char           *slave;
+
+    if ((t->fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0
+            || grantpt(t->fd) < 0 || unlockpt(t->fd) < 0
+            || !(slave = ptsname(t->fd)))
+        die("can't open pty: %s\n", strerror(errno));
+    ioctl(t->fd, TIOCSWINSZ, &ws);
+    t->ncarry = 0;
+
+    if ((t->pid = fork()) < 0)
+        die("fork error: %s\n", strerror(errno));
+
+    if (!t->pid) {
+        int fd;
+
+        setsid();
+        if ((fd = open(slave, O_RDWR)) < 0)
+            _exit(127);
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        if (fd > STDERR_FILENO)
+            close(fd);
+        close(t->fd);
+
+        setenv("TERM", "xterm", 1);
+        setenv("HOME", g_home, 1);
+        execl(ice, ice, "-f", file, (char *)NULL);
+        _exit(127);
+    }
+}
+
+static void
+term_stop(Term *t)
+{
+    int       status;
+    long long end = now_ms() + 2000;
+    char      buf[4096];
+
+    if (write(t->fd, KEY_QUIT, sizeof(KEY_QUIT)-1) < 0)
+        kill(t->pid, SIGKILL);
+
+    /* keep reading so ice never blocks on a full pty */
+    while (waitpid(t->pid, &status, WNOHANG) == 0) {
+        struct pollfd pfd = { t->fd, POLLIN, 0 };
+
+        if (now_ms() > end)
+            kill(t->pid, SIGKILL);
+        if (poll(&pfd, 1, 10) > 0 && read(t->fd, buf, sizeof(buf)) <= 0)
+            usleep(1000);
+    }
+    close(t->fd);
+}
+
+/* read whatever is there within timeout_ms, stops early at the end
+ * of a frame or at what (if not NULL). returns 1 if it got there */
+static int
+term_read(Term *t, int timeout_ms, const char *what, size_t *nbytes)
+{
+    const char *mark = what? what: SYNC_END;
+    size_t     mlen  = strlen(mark);
+    long long  end   = now_ms() + timeout_ms;
+    char       buf[sizeof(t->carry) + 65536];
+
+    for (;;) {
+        struct pollfd pfd = { t->fd, POLLIN, 0 };
+        long long     left = end - now_ms();
+        ssize_t       n;
+        size_t        len, i;
+
+        if (left < 0 || poll(&pfd, 1, (int)left) <= 0)
+            return 0;
+
+        memcpy(buf, t->carry, t->ncarry);
+        if ((n = read(t->fd, buf + t->ncarry, sizeof(buf) - t->ncarry)) <= 0)
+            return 0;
+        if (nbytes)
+            *nbytes += n;
+        len = t->ncarry + n;
+
+        for (i = 0; i + mlen <= len; i++)
+            if (buf[i] == mark[0] && !memcmp(&buf[i], mark, mlen)) {
+                t->ncarry = 0;
+                return 1;
+            }
+
+        t->ncarry = len < mlen - 1? len: mlen - 1;
+        memcpy(t->carry, &buf[len - t->ncarry], t->ncarry);
+    }
+}
+
+/* let startup output pass and turn on synchronized output */
+static void
+term_settle(Term *t)
+{
+    if (!term_read(t, BENCH_FRAME_MS, SYNC_QUERY, NULL))
+        die("ice didn't ask for synchronized output\n");
+    if (write(t->fd, SYNC_REPLY, sizeof(SYNC_REPLY)-1) < 0)
+        die("pty write error: %s\n", strerror(errno));
+    while (term_read(t, BENCH_IDLE_MS, NULL, NULL));
+    t->ncarry = 0;
+}
+
+/* send one key and time it until its frame is out, the key has to
+ * change the screen or there is no frame to wait for */
+static void
+term_key(Term *t, Stats *st, const char *key, size_t len)
+{
+    long long start;
+    size_t    nbytes = 0;
+
+    start = now_us();
+    if (write(t->fd, key, len) != (ssize_t)len)
+        die("pty write error: %s\n", strerror(errno));
+
+    if (!term_read(t, BENCH_FRAME_MS, NULL, &nbytes)) {
+        st->missed++;
+        return;
+    }
+
+    if (st->n == st->cap) {
+        st->cap   = st->cap? st->cap * 2: 256;
+        st->lat   = realloc(st->lat, st->cap * sizeof(*st->lat));
+        st->bytes = realloc(st->bytes, st->cap * sizeof(*st->bytes));
+        if (!st->lat || !st->bytes)
+            die("stats alloc err\n");
+    }
+    st->lat[st->n]   = now_us() - start;
+    st->bytes[st->n] = nbytes;
+    st->n++;
+}
+
+static void
+scenario_type(Term *t, Stats *st)
+{
+    const char *text = "for f in *.log; do gzip -9 \"$f\"; done ";
+    size_t     i, n = strlen(text);
+
+    for (i = 0; i < 200; i++)
+        term_key(t, st, &text[i % n], 1);
+}
+
+static void
+scenario_scroll(Term *t, Stats *st)
+{
+    size_t i;
+
+    for (i = 0; i < 300; i++)
+        term_key(t, st, KEY_DOWN, sizeof(KEY_DOWN)-1);
+    for (i = 0; i < 300; i++)
+        term_key(t, st, KEY_UP, sizeof(KEY_UP)-1);
+}
+
+static void
+scenario_paste(Term *t, Stats *st)
+{
+    char   buf[PASTE_LINES * 64];
+    size_t len, i, j;
+
+    /* every paste differs, one that looks like the last draws nothing */
+    for (i = 0; i < 20; i++) {
+        len = sprintf(buf, "%s", PASTE_BEGIN);
+        for (j = 0; j < PASTE_LINES; j++)
+            len += sprintf(&buf[len], "printf '%%s\\n' paste %zu line %zu\n",
+                    i, j);
+        len += sprintf(&buf[len], "%s", PASTE_END);
+        term_key(t, st, buf, len);
+    }
+}
+
+static int
+cmp_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+static long long
+percentile(long long *sorted, size_t n, int p)
+{
+    return n? sorted[(n - 1) * p / 100]: 0;
+}
+
+static void
+report(const char *name, size_t lines, Stats *st)
+{
+    size_t total = 0, max = 0, i;
+
+    for (i = 0; i < st->n; i++) {
+        total += st->bytes[i];
+        if (st->bytes[i] > max) max = st->bytes[i];
+    }
+    qsort(st->lat, st->n, sizeof(*st->lat), cmp_ll);
+
+    printf("{\"scenario\": \"%s\", \"lines\": %zu, \"frames\": %zu, "
+            "\"missed\": %zu, \"p50_us\": %lld, \"p90_us\": %lld, "
+            "\"p99_us\": %lld, \"max_us\": %lld, \"bytes_per_frame\": %.1f, "
+            "\"max_frame_bytes\": %zu}\n",
+            name, lines, st->n, st->missed,
+            percentile(st->lat, st->n, 50), percentile(st->lat, st->n, 90),
+            percentile(st->lat, st->n, 99),
+            st->n? st->lat[st->n - 1]: 0,
+            st->n? total / (double)st->n: 0.0, max);
+    fflush(stdout);
+}
+
+/* a buffer of n lines of plain commands */
+static void
+make_buffer(const char *path, size_t n)
+{
+    FILE   *f;
+    size_t i;
+
+    if (!(f = fopen(path, "w")))
+        die("can't create %s: %s\n", path, strerror(errno));
+    for (i = 0; i < n; i++)
+        fprintf(f, "echo line %zu\n", i);
+    fclose(f);
+}
+
+/* the scratch dir only holds the buffers and what ice left in HOME */
+static void
+cleanup(void)
+{
+    DIR           *d;
+    struct dirent *e;
+    char          path[sizeof(g_home) + sizeof(e->d_name)];
+
+    if (!(d = opendir(g_home)))
+        return;
+    while ((e = readdir(d)))
+        if (strcmp(e->d_name, ".") && strcmp(e->d_name, "..")) {
+            snprintf(path, sizeof(path), "%s/%s", g_home, e->d_name);
+            unlink(path);
+        }
+    closedir(d);
+    rmdir(g_home);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const size_t sizes[] = { 10000, 100000 };
+    static const struct {
+        const char *name;
+        Scenario   run;
+    } scenarios[] = {
+        { "type",   scenario_type   },
+        { "scroll", scenario_scroll },
+        { "paste",  scenario_paste  },
+    };
+    const char *ice = argc > 1? argv[1]: "./ice";
+    char       file[256];
+    size_t     s, i;
+
+    if (!mkdtemp(g_home))
+        die("can't create %s: %s\n", g_home, strerror(errno));
+    atexit(cleanup);
+
+    for (s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        snprintf(file, sizeof(file), "%s/buf%zu", g_home, sizes[s]);
+        make_buffer(file, sizes[s]);
+
+        for (i = 0; i < sizeof(scenarios) / sizeof(*scenarios); i++) {
+            Term  t;
+            Stats st = {0};
+
+            term_start(&t, ice, file);
+            term_settle(&t);
+            scenarios[i].run(&t, &st);
+            term_stop(&t);
+
+            report(scenarios[i].name, sizes[s], &st);
+            free(st.lat);
+            free(st.bytes);
+        }
+    }
+
+    return 0;
+}
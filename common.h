@@ -4,6 +4,8 @@
 #define UNUSED(x) (void)(x)
 
 void die(const char *errstr, ...);
+long long now_ms(void);
+long long now_us(void);
 
 #endif
 
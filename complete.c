@@ -0,0 +1,420 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "complete.h"
+
+/*
+ * the cache file holds, for every PATH directory when it was scanned,
+ * a "<mtime sec> <mtime nsec> <count> <dir>" line and then its names,
+ * one per line. a directory whose mtime still matches isn't rescanned
+ */
+#define CACHE_MAGIC "ICEPATH1\n"
+
+typedef struct {
+    char      *dir;
+    long long sec;
+    long      nsec;
+    CompList  names;
+} CacheDir;
+
+static void
+complist_add(CompList *l, const char *name, size_t len)
+{
+    if (l->n == l->cap) {
+        l->cap = l->cap? l->cap * 2: 64;
+        if (!(l->v = realloc(l->v, l->cap * sizeof(char *))))
+            die("complete alloc err\n");
+    }
+
+    if (!(l->v[l->n] = malloc(len + 1)))
+        die("complete alloc err\n");
+    memcpy(l->v[l->n], name, len);
+    l->v[l->n++][len] = 0;
+}
+
+void
+complist_free(CompList *l)
+{
+    size_t i;
+
+    for (i = 0; i < l->n; i++)
+        free(l->v[i]);
+    free(l->v);
+    memset(l, 0, sizeof(*l));
+}
+
+static int
+cmp_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void
+complist_sort(CompList *l)
+{
+    size_t i, n = 0;
+
+    qsort(l->v, l->n, sizeof(char *), cmp_names);
+
+    for (i = 0; i < l->n; i++) {
+        if (n && !strcmp(l->v[n-1], l->v[i]))
+            free(l->v[i]);
+        else
+            l->v[n++] = l->v[i];
+    }
+    l->n = n;
+}
+
+/* complete_stop was called, a scan in progress gives up */
+static int
+stopped(Complete *c)
+{
+    int stop;
+
+    pthread_mutex_lock(&c->lock);
+    stop = c->stop;
+    pthread_mutex_unlock(&c->lock);
+
+    return stop;
+}
+
+/* entries of dir, with a '/' after directories. only executable
+ * files if exec is set */
+static void
+scan_dir(Complete *c, const char *dir, int exec, CompList *out)
+{
+    DIR           *d = opendir(dir);
+    struct dirent *e;
+
+    if (!d) return;
+
+    while (!stopped(c) && (e = readdir(d))) {
+        struct stat st;
+        int         isdir = e->d_type == DT_DIR;
+        size_t      len   = strlen(e->d_name);
+
+        if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+            continue;
+
+        /* links and unknown types need a look at the target */
+        if (exec || e->d_type == DT_LNK || e->d_type == DT_UNKNOWN) {
+            if (fstatat(dirfd(d), e->d_name, &st, 0) < 0)
+                continue;
+            isdir = S_ISDIR(st.st_mode);
+            if (exec && (isdir || !(st.st_mode & 0111)))
+                continue;
+        }
+
+        complist_add(out, e->d_name, len);
+        if (isdir) {
+            out->v[out->n-1] = realloc(out->v[out->n-1], len + 2);
+            if (!out->v[out->n-1])
+                die("complete alloc err\n");
+            memcpy(&out->v[out->n-1][len], "/", 2);
+        }
+    }
+
+    closedir(d);
+}
+
+static size_t
+cache_load(const char *path, CacheDir **dirs)
+{
+    FILE    *fp = fopen(path, "r");
+    char    *line = NULL;
+    size_t  cap = 0, n = 0, size = 0;
+    ssize_t len;
+
+    *dirs = NULL;
+    if (!fp) return 0;
+
+    if ((len = getline(&line, &cap, fp)) < 0 || strcmp(line, CACHE_MAGIC))
+        goto out;
+
+    while ((len = getline(&line, &cap, fp)) > 0) {
+        CacheDir d = { 0 };
+        size_t   count, i;
+        int      off;
+
+        line[len-1] = 0;
+        if (sscanf(line, "%lld %ld %zu %n", &d.sec, &d.nsec, &count, &off)
+                != 3 || !(d.dir = strdup(&line[off])))
+            break;
+
+        for (i = 0; i < count && (len = getline(&line, &cap, fp)) > 0; i++)
+            complist_add(&d.names, line, len - 1);
+
+        if (n == size) {
+            size  = size? size * 2: 16;
+            *dirs = realloc(*dirs, size * sizeof(CacheDir));
+            if (!*dirs) die("complete alloc err\n");
+        }
+        (*dirs)[n++] = d;
+    }
+
+out:
+    free(line);
+    fclose(fp);
+    return n;
+}
+
+/* written to a temporary file and renamed, so a reader
+ * never sees it half done */
+static void
+cache_save(const char *path, CacheDir *dirs, size_t n)
+{
+    char   tmp[4096];
+    FILE   *fp;
+    size_t i, j;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    if (!(fp = fopen(tmp, "w")))
+        return;
+
+    fputs(CACHE_MAGIC, fp);
+    for (i = 0; i < n; i++) {
+        fprintf(fp, "%lld %ld %zu %s\n", dirs[i].sec, dirs[i].nsec,
+                dirs[i].names.n, dirs[i].dir);
+        for (j = 0; j < dirs[i].names.n; j++)
+            fprintf(fp, "%s\n", dirs[i].names.v[j]);
+    }
+
+    if (fclose(fp) || rename(tmp, path))
+        unlink(tmp);
+}
+
+/* the executables of every PATH directory, from the cache where
+ * the directory hasn't changed since. a stop cuts it short and
+ * leaves the cache as it was */
+static void
+build_index(Complete *c, CompList *cmds)
+{
+    CacheDir *old, *dirs = NULL;
+    size_t   nold = cache_load(c->cache, &old), n = 0, i, j;
+    int      changed = 0;
+    char     *p, *dir;
+
+    for (p = c->path; !stopped(c) && (dir = strsep(&p, ":"));) {
+        struct stat st;
+        CacheDir    d = { 0 };
+
+        if (!*dir) dir = ".";
+        if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode))
+            continue;
+
+        d.sec  = st.st_mtim.tv_sec;
+        d.nsec = st.st_mtim.tv_nsec;
+
+        for (i = 0; i < nold; i++)
+            if (old[i].dir && !strcmp(old[i].dir, dir)
+                    && old[i].sec == d.sec && old[i].nsec == d.nsec) {
+                d.dir         = old[i].dir;
+                d.names       = old[i].names;
+                old[i].dir    = NULL;
+                memset(&old[i].names, 0, sizeof(CompList));
+                break;
+            }
+
+        if (!d.dir) {
+            if (!(d.dir = strdup(dir)))
+                die("complete alloc err\n");
+            scan_dir(c, dir, 1, &d.names);
+            changed = 1;
+        }
+
+        if (!(dirs = realloc(dirs, (n + 1) * sizeof(CacheDir))))
+            die("complete alloc err\n");
+        dirs[n++] = d;
+    }
+
+    if ((changed || n != nold) && !stopped(c))
+        cache_save(c->cache, dirs, n);
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < dirs[i].names.n; j++)
+            complist_add(cmds, dirs[i].names.v[j],
+                    strlen(dirs[i].names.v[j]));
+        complist_free(&dirs[i].names);
+        free(dirs[i].dir);
+    }
+    for (i = 0; i < nold; i++) {
+        complist_free(&old[i].names);
+        free(old[i].dir);
+    }
+    free(dirs);
+    free(old);
+
+    complist_sort(cmds);
+}
+
+static void *
+complete_worker(void *arg)
+{
+    Complete *c   = arg;
+    CompList cmds = { 0 };
+
+    build_index(c, &cmds);
+
+    pthread_mutex_lock(&c->lock);
+    c->cmds       = cmds;
+    c->cmds_ready = 1;
+
+    while (!c->stop) {
+        CompList names = { 0 };
+        unsigned id;
+        char     *dir;
+
+        if (!c->req) {
+            pthread_cond_wait(&c->cond, &c->lock);
+            continue;
+        }
+
+        dir    = c->req;
+        id     = c->req_id;
+        c->req = NULL;
+        pthread_mutex_unlock(&c->lock);
+
+        scan_dir(c, dir, 0, &names);
+        complist_sort(&names);
+        free(dir);
+
+        pthread_mutex_lock(&c->lock);
+        complist_free(&c->res);
+        c->res       = names;
+        c->res_id    = id;
+        c->res_ready = 1;
+        write(c->wake[1], "", 1);
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    return NULL;
+}
+
+void
+complete_start(Complete *c, const char *cache)
+{
+    const char *path = getenv("PATH");
+
+    memset(c, 0, sizeof(*c));
+    c->wake[0] = c->wake[1] = -1;
+
+    if (!(c->cache = strdup(cache)) || !(c->path = strdup(path? path: "")))
+        die("complete alloc err\n");
+
+    if (pipe(c->wake) < 0)
+        return;
+    fcntl(c->wake[0], F_SETFD, FD_CLOEXEC);
+    fcntl(c->wake[1], F_SETFD, FD_CLOEXEC);
+    fcntl(c->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(c->wake[1], F_SETFL, O_NONBLOCK);
+
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    c->running = !pthread_create(&c->thread, NULL, complete_worker, c);
+}
+
+void
+complete_stop(Complete *c)
+{
+    if (c->running) {
+        pthread_mutex_lock(&c->lock);
+        c->stop = 1;
+        pthread_cond_signal(&c->cond);
+        pthread_mutex_unlock(&c->lock);
+        pthread_join(c->thread, NULL);
+
+        pthread_mutex_destroy(&c->lock);
+        pthread_cond_destroy(&c->cond);
+        c->running = 0;
+    }
+
+    if (c->wake[0] >= 0) {
+        close(c->wake[0]);
+        close(c->wake[1]);
+    }
+
+    complist_free(&c->cmds);
+    complist_free(&c->res);
+    free(c->req);
+    free(c->cache);
+    free(c->path);
+}
+
+/* range of commands starting with prefix, 0 while the
+ * index isn't built yet */
+int
+complete_commands(Complete *c, const char *prefix, size_t n,
+        size_t *first, size_t *count)
+{
+    size_t lo = 0, hi;
+    int    ready;
+
+    if (!c->running) return 0;
+
+    pthread_mutex_lock(&c->lock);
+    ready = c->cmds_ready;
+    pthread_mutex_unlock(&c->lock);
+    if (!ready) return 0;
+
+    /* the list doesn't change once it's ready */
+    for (hi = c->cmds.n; lo < hi;) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (strncmp(c->cmds.v[mid], prefix, n) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *first = lo;
+    for (hi = lo; hi < c->cmds.n && !strncmp(c->cmds.v[hi], prefix, n);)
+        hi++;
+    *count = hi - lo;
+
+    return 1;
+}
+
+/* ask for a listing of dir, a newer request replaces an older one */
+void
+complete_dir(Complete *c, const char *dir, unsigned id)
+{
+    if (!c->running) return;
+
+    pthread_mutex_lock(&c->lock);
+    free(c->req);
+    if (!(c->req = strdup(dir)))
+        die("complete alloc err\n");
+    c->req_id = id;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* take the listing that woke the loop, 0 if there is none */
+int
+complete_take(Complete *c, unsigned *id, CompList *names)
+{
+    char buf[64];
+    int  ready;
+
+    while (read(c->wake[0], buf, sizeof(buf)) > 0);
+
+    pthread_mutex_lock(&c->lock);
+    if ((ready = c->res_ready)) {
+        *names       = c->res;
+        *id          = c->res_id;
+        c->res_ready = 0;
+        memset(&c->res, 0, sizeof(c->res));
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    return ready;
+}
@@ -0,0 +1,42 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <pthread.h>
+
+/* sorted names */
+typedef struct {
+    char   **v;
+    size_t n;
+    size_t cap;
+} CompList;
+
+/* completion data from a worker thread: the executables on PATH,
+ * then directory listings on request. a byte on the wake pipe tells
+ * the main loop a listing is in */
+typedef struct {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             wake[2];
+    char            *cache;     /* PATH index cache file     */
+    char            *path;      /* copy of $PATH             */
+    CompList        cmds;       /* valid once cmds_ready     */
+    int             cmds_ready;
+    char            *req;       /* directory to list         */
+    unsigned        req_id;
+    CompList        res;        /* listing of request res_id */
+    unsigned        res_id;
+    int             res_ready;
+    int             stop;
+    int             running;
+} Complete;
+
+void complete_start(Complete *c, const char *cache);
+void complete_stop(Complete *c);
+int  complete_commands(Complete *c, const char *prefix, size_t n,
+                       size_t *first, size_t *count);
+void complete_dir(Complete *c, const char *dir, unsigned id);
+int  complete_take(Complete *c, unsigned *id, CompList *names);
+void complist_free(CompList *l);
+
+#endif
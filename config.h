@@ -12,36 +12,101 @@
 
 #define SHELL_COMMAND "sh"
 
-#define HELP_TEXT "Ctrl+Q: exit, Ctrl+S: exit & exec"
+/* queued input events are applied in one batch before the next
+ * redraw, but never for longer than this many milliseconds */
+#define INPUT_BATCH_MS 16
+
+/* a bracketed paste whose end marker doesn't come within this many
+ * milliseconds of its last key is applied as it is */
+#define PASTE_IDLE_MS 1000
+
+/* background runs keep the newest OUTPUT_RING_SIZE bytes of output,
+ * shown in a pane of OUTPUT_PANE_HEIGHT rows (title row included) */
+#define OUTPUT_RING_SIZE   (64 * 1024)
+#define OUTPUT_PANE_HEIGHT 8
+
+/* a stopped run or check gets SIGTERM, and SIGKILL if it is still
+ * around STOP_KILL_MS later */
+#define STOP_KILL_MS 2000
+
+/* the script is checked with SHELL_COMMAND -n in the background
+ * once typing pauses for CHECK_DELAY_MS (0 turns that off), the line
+ * it complains about is drawn in CHECK_ERROR_COLOR */
+#define CHECK_DELAY_MS    500
+#define CHECK_ERROR_COLOR TB_RED
+
+/* undo keeps at most this many bytes of edits, the oldest go first.
+ * big edits are held apart and get as much again */
+#define UNDO_LOG_SIZE (4 * 1024 * 1024)
+
+/* edits are journaled to JOURNAL_FILE.<pid> in $HOME (empty turns it
+ * off) and synced to disk at most every JOURNAL_SYNC_MS, so -r can
+ * bring back the newest session that died */
+#define JOURNAL_FILE    ".ice_journal"
+#define JOURNAL_SYNC_MS 1000
+
+/* executed buffers are kept in HISTORY_FILE in $HOME (empty turns
+ * it off), plus an index next to it with ".idx" appended */
+#define HISTORY_FILE ".ice_history"
+
+/* history search matches for at most this long per frame,
+ * the list fills in over the next frames */
+#define SEARCH_STEP_MS 8
+
+/* tab completes commands from PATH, which is indexed in the
+ * background and cached in COMPLETE_CACHE_FILE in $HOME */
+#define COMPLETE_CACHE_FILE ".ice_path_cache"
+
+/* with -j, 1 makes every run of non blank lines one job instead
+ * of every line */
+#define JOB_SPLIT_BLOCKS 0
+
+#define HELP_TEXT "Ctrl+Q: exit, Ctrl+S: exit & exec, Ctrl+E: run"
 
 static const char *g_usage =
 "ice - interactive commands editor\n"
 "\n"
-"usage: ice [-h] [-e] [-c]\n"
+"usage: ice [-h] [-e] [-c] [-p] [-j n] [-t] [-r] [-f file]\n"
 "\n"
 "flags:\n"
 "   -h  show this help and exit\n"
 "   -e  show exit code after execution\n"
 "   -c  print commands before execution\n"
+"   -f  load commands from file (- for stdin)\n"
+"   -p  keep one shell running for all ctrl+e runs\n"
+"   -j  on exit run each line as its own job, n at a time\n"
+"   -t  run lines as timed jobs and print time and memory of each\n"
+"   -r  recover the buffer of a session that died\n"
 "\n"
 "description:\n"
 "   ice is a TUI editor for interactive command composition.\n"
 "   edit commands in a familiar editor interface, then execute\n"
 "   them as a bash script.\n"
 "\n"
+"   syntax errors are found in the background, the bad line\n"
+"   is drawn in red and the error replaces the help line.\n"
+"\n"
 "   also you can edit config.h to change some default settings.\n"
 "\n"
 "global controls:\n"
 "   ctrl+c / ctrl+q          exit without execution\n"
 "   ctrl+s                   exit and execute commands\n"
+"   ctrl+e                   run commands, output goes to a pane\n"
+"   ctrl+l                   run marked block or current line\n"
+"   ctrl+b                   start/drop block mark at current line\n"
+"   ctrl+o                   show/hide the output pane\n"
+"   ctrl+p                   browse executed buffers\n"
+"   ctrl+r                   fuzzy search executed buffers\n"
 "\n"
 "edit mode controls:\n"
 "   arrow keys               navigate\n"
 "   ctrl + left/right        jump by word\n"
 "   ctrl+w / ctrl+backspace  delete left word\n"
-"   tab                      insert 4 spaces\n"
+"   tab                      complete command or path,\n"
+"                            insert 4 spaces after a blank\n"
 "   enter                    insert new line\n"
 "   backspace                delete left symbol\n"
+"   ctrl+z / ctrl+y          undo / redo\n"
 "   any printable ascii      insert character\n"
 ;
 
@@ -51,4 +116,15 @@ static const char *g_usage =
 
 #define KEY_EXIT_EXECUTE TB_KEY_CTRL_S
 
+#define KEY_RUN           TB_KEY_CTRL_E
+#define KEY_RUN_BLOCK     TB_KEY_CTRL_L
+#define KEY_MARK          TB_KEY_CTRL_B
+#define KEY_TOGGLE_OUTPUT TB_KEY_CTRL_O
+
+#define KEY_HISTORY TB_KEY_CTRL_P
+#define KEY_SEARCH  TB_KEY_CTRL_R
+
+#define KEY_UNDO TB_KEY_CTRL_Z
+#define KEY_REDO TB_KEY_CTRL_Y
+
 #endif
@@ -0,0 +1,185 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "linelist.h"
+#include "history.h"
+
+#define HISTORY_MAGIC     "ICEHIST1"
+#define HISTORY_MAGIC_LEN 8
+
+void
+history_init(History *h, const char *path)
+{
+    size_t n = strlen(path);
+
+    memset(h, 0, sizeof(*h));
+    if (!(h->path = strdup(path)) || !(h->idxpath = malloc(n + 5)))
+        die("history alloc err\n");
+    memcpy(h->idxpath, path, n);
+    memcpy(&h->idxpath[n], ".idx", 5);
+}
+
+static void
+history_unmap(History *h)
+{
+    if (h->recs)
+        munmap((void *)((const char *)h->recs - HISTORY_MAGIC_LEN),
+                h->map_len);
+    if (h->data)
+        munmap((void *)h->data, h->data_len);
+
+    h->recs  = NULL;
+    h->data  = NULL;
+    h->count = 0;
+}
+
+void
+history_free(History *h)
+{
+    history_unmap(h);
+    free(h->path);
+    free(h->idxpath);
+}
+
+/* append lines from..to (to NULL for up to the end) unless they are
+ * what the newest entry already holds. the index is written after
+ * the text and under a lock, so readers never see half an entry */
+int
+history_add(History *h, Line *from, Line *to)
+{
+    HistRec     rec = { 0 };
+    struct stat st;
+    Line        *line;
+    size_t      nbytes, i;
+    int         fd, idxfd, rv = -1;
+
+    if (!h->path) return -1;
+
+    rec.hash = 14695981039346656037ULL;
+    for (line = from; line; line = line == to? NULL: line->next) {
+        for (i = 0; i < line->len; i++)
+            rec.hash = (rec.hash ^ (unsigned char)line_at(line, i))
+                * 1099511628211ULL;
+        rec.hash = (rec.hash ^ '\n') * 1099511628211ULL;
+        rec.len += line->len + 1;
+        rec.lines++;
+    }
+    rec.time = time(NULL);
+
+    if ((idxfd = open(h->idxpath, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0)
+        return -1;
+    if ((fd = open(h->path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+        close(idxfd);
+        return -1;
+    }
+
+    flock(idxfd, LOCK_EX);
+    if (fstat(idxfd, &st) < 0)
+        goto out;
+
+    if (st.st_size < HISTORY_MAGIC_LEN) {
+        if (pwrite(idxfd, HISTORY_MAGIC, HISTORY_MAGIC_LEN, 0)
+                != HISTORY_MAGIC_LEN)
+            goto out;
+        st.st_size = HISTORY_MAGIC_LEN;
+    } else {
+        HistRec last;
+        off_t   n = (st.st_size - HISTORY_MAGIC_LEN) / sizeof(HistRec);
+
+        if (n && pread(idxfd, &last, sizeof(last), HISTORY_MAGIC_LEN
+                    + (n-1) * sizeof(HistRec)) == sizeof(last)
+                && last.hash == rec.hash && last.len == rec.len) {
+            rv = 0;
+            goto out;
+        }
+        /* drop a record torn by a crash */
+        st.st_size = HISTORY_MAGIC_LEN + n * sizeof(HistRec);
+    }
+
+    rec.off = lseek(fd, 0, SEEK_END);
+    if (linelist_write(from, to, fd, &nbytes) < 0 || nbytes != rec.len) {
+        ftruncate(fd, rec.off);
+        goto out;
+    }
+
+    if (pwrite(idxfd, &rec, sizeof(rec), st.st_size) == sizeof(rec))
+        rv = 0;
+
+out:
+    flock(idxfd, LOCK_UN);
+    close(fd);
+    close(idxfd);
+
+    /* the mappings don't cover the new entry */
+    history_unmap(h);
+    return rv;
+}
+
+/* map the index and then the data, every entry the index held at
+ * that point has its text in the data mapping */
+void
+history_map(History *h)
+{
+    struct stat st;
+    void        *p;
+    int         fd;
+
+    if (!h->path || h->recs) return;
+
+    if ((fd = open(h->idxpath, O_RDONLY | O_CLOEXEC)) < 0)
+        return;
+    if (fstat(fd, &st) < 0
+            || st.st_size < HISTORY_MAGIC_LEN + (off_t)sizeof(HistRec)
+            || (p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0))
+            == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+    close(fd);
+
+    if (memcmp(p, HISTORY_MAGIC, HISTORY_MAGIC_LEN)) {
+        munmap(p, st.st_size);
+        return;
+    }
+
+    h->map_len = st.st_size;
+    h->recs    = (const HistRec *)((char *)p + HISTORY_MAGIC_LEN);
+    h->count   = (st.st_size - HISTORY_MAGIC_LEN) / sizeof(HistRec);
+
+    if ((fd = open(h->path, O_RDONLY | O_CLOEXEC)) < 0
+            || fstat(fd, &st) < 0 || !st.st_size
+            || (p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0))
+            == MAP_FAILED) {
+        if (fd >= 0) close(fd);
+        history_unmap(h);
+        return;
+    }
+    close(fd);
+
+    h->data     = p;
+    h->data_len = st.st_size;
+}
+
+/* text of entry i, 0 is the oldest. NULL if it doesn't fit the data,
+ * which only a damaged file does */
+const char *
+history_entry(History *h, size_t i, const HistRec **rec)
+{
+    const HistRec *r = &h->recs[i];
+
+    *rec = r;
+    if (r->off > h->data_len || r->len > h->data_len - r->off)
+        return NULL;
+
+    return &h->data[r->off];
+}
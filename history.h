@@ -0,0 +1,34 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+/* index record, one per entry. the index file is HISTORY_MAGIC then
+ * these back to back, so entry i sits at a fixed offset */
+typedef struct {
+    uint64_t off;   /* text in the data file */
+    int64_t  time;  /* when it was added     */
+    uint64_t hash;  /* of the text           */
+    uint32_t len;
+    uint32_t lines;
+} HistRec;
+
+/* executed buffers, appended to a data file and its index. both are
+ * only mapped when the entries are needed */
+typedef struct {
+    char          *path;     /* data file         */
+    char          *idxpath;  /* path ".idx"       */
+    const char    *data;     /* mappings, or NULL */
+    size_t        data_len;
+    const HistRec *recs;
+    size_t        count;
+    size_t        map_len;   /* of the index      */
+} History;
+
+void history_init(History *h, const char *path);
+void history_free(History *h);
+int  history_add(History *h, Line *from, Line *to);
+void history_map(History *h);
+const char *history_entry(History *h, size_t i, const HistRec **rec);
+
+#endif
@@ -2,8 +2,13 @@
 #define _DEFAULT_SOURCE
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 char *argv0;
 
@@ -15,30 +20,362 @@ char *argv0;
 #include "config.h"
 #include "common.h"
 #include "linelist.h"
+#include "load.h"
+#include "ring.h"
+#include "shell.h"
+#include "jobs.h"
+#include "undo.h"
+#include "journal.h"
+#include "history.h"
+#include "search.h"
+#include "complete.h"
+
+/* bracketed paste markers, reported as these keys */
+#define PASTE_ENABLE    "\x1b[?2004h"
+#define PASTE_DISABLE   "\x1b[?2004l"
+#define PASTE_BEGIN     "\x1b[200~"
+#define PASTE_END       "\x1b[201~"
+#define PASTE_MARK_LEN  6
+#define KEY_PASTE_BEGIN (TB_KEY_MOUSE_WHEEL_DOWN - 1)
+#define KEY_PASTE_END   (TB_KEY_MOUSE_WHEEL_DOWN - 2)
+
+/* asks if the terminal knows synchronized output (mode 2026), the
+ * reply "\x1b[?2026;<n>$y" is reported as this key with ch = n */
+#define SYNC_QUERY      "\x1b[?2026$p"
+#define SYNC_REPLY      "\x1b[?2026;"
+#define SYNC_REPLY_LEN  8
+#define KEY_SYNC_REPLY  (TB_KEY_MOUSE_WHEEL_DOWN - 3)
+
+/* a coprocess run ends by printing RUN_MARK "ice <id> <status>" RUN_MARK */
+#define RUN_MARK        '\036'
+#define RUN_MARK_MAX    32
+#define RUN_MARK_STR    "\036"
+
+/* syntax check output kept, the first line is the message */
+#define CHECK_OUT_MAX   256
+
+/* draw_screen walks the cached top line this far at most,
+ * longer jumps look it up in the line index */
+#define TOP_WALK_MAX    64
+
+/* what draw_screen has to repaint */
+enum {
+    REDRAW_LINES  = 1 << 0, /* lines dirty_from..dirty_to */
+    REDRAW_STATUS = 1 << 1, /* msgline                    */
+    REDRAW_OUTPUT = 1 << 2, /* output pane                */
+    REDRAW_ALL    = 1 << 3  /* whole screen               */
+};
+
+/* children stopped but not reaped yet, at most this many */
+#define REAP_MAX        16
+
+typedef struct {
+    pid_t     pid;
+    long long kill_at;        /* now_ms for SIGKILL, 0 once sent */
+} Reap;
 
 typedef struct {
     LineList *lines;          /* lines list               */
     Line     *cl;             /* current line             */
     size_t   cp;              /* current position in line */
+    size_t   ln;              /* current line number      */
+    Line     *top;            /* first line on screen     */
+    size_t   vshift;          /* number of the top line   */
+    size_t   hshift;          /* first column on screen   */
+    int      redraw;          /* REDRAW_* flags           */
+    size_t   dirty_from;      /* first dirty line number  */
+    size_t   dirty_to;        /* last dirty line number   */
+    int      pasting;         /* inside bracketed paste   */
+    char     *paste;          /* pasted text so far       */
+    size_t   paste_len;
+    size_t   paste_cap;
+    int      paste_cr;        /* last pasted key was a \r */
+    long long paste_at;       /* now_ms of the last pasted key */
+    Line     *mark;           /* block start, NULL if none */
+    LoadBuf  load;            /* preloaded file contents  */
+    UndoLog  undo;            /* edits that can be undone */
+    Journal  journal;         /* edits for crash recovery */
+    History  history;         /* executed buffers         */
+    int      browsing;        /* history browser is open  */
+    size_t   hist_sel;        /* selected entry, 0 newest */
+    size_t   hist_top;        /* first entry on screen    */
+    Search   search;          /* history search index     */
+    int      searching;       /* browser shows search hits */
+    char     query[SEARCH_QUERY_MAX];
+    size_t   query_len;
+    Shell    run;             /* background run           */
+    char     *run_pending;    /* script part not sent yet */
+    size_t   run_pending_len;
+    size_t   run_pending_off;
+    int      run_status;      /* wait status of last run  */
+    int      running;         /* a run is in progress     */
+    int      coproc;          /* keep the shell between runs */
+    unsigned run_id;          /* current coprocess run    */
+    char     endmark[RUN_MARK_MAX]; /* coprocess marker so far */
+    size_t   endmark_len;
+    Shell    check;           /* background syntax check  */
+    char     *check_buf;      /* buffer copy it reads     */
+    size_t   check_len;
+    size_t   check_off;
+    char     check_out[CHECK_OUT_MAX]; /* its output so far */
+    size_t   check_out_len;
+    uint64_t check_hash;      /* content of the last check */
+    long long check_due;      /* now_ms to check at, 0 if not due */
+    size_t   err_line;        /* line of the error from 1, 0 if none */
+    char     err_msg[CHECK_OUT_MAX];
+    Reap     reap[REAP_MAX];  /* stopped children         */
+    size_t   nreap;
+    int      child_wake[2];   /* SIGCHLD self-pipe        */
+    Complete comp;            /* tab completion worker    */
+    unsigned comp_id;         /* last path completion asked */
+    size_t   comp_ln;         /* where it was asked       */
+    size_t   comp_cp;
+    unsigned long comp_edits;
+    char     comp_base[256];  /* file name part to complete */
+    unsigned long edits;      /* edits made so far        */
+    char     hint[256];       /* msgline text until the next key */
+    Ring     output;          /* output of the last run   */
+    int      show_output;     /* output pane visible      */
+    size_t   pane_h;          /* pane rows on screen      */
     int      execute_on_exit; /* 1 or 0 */
 } State;
 
 static State g_state = {};
 
 static void
-state_init()
+state_init(const char *path)
 {
     g_state.lines           = linelist_create();
-    linelist_append(g_state.lines, "");
+    if (path) {
+        load_file(&g_state.load, path);
+        load_lines(&g_state.load, g_state.lines);
+    }
+    if (!g_state.lines->head)
+        linelist_append(g_state.lines, "");
     g_state.cl              = g_state.lines->head;
     g_state.cp              = 0;
+    g_state.ln              = 0;
+    g_state.top             = g_state.cl;
+    g_state.vshift          = 0;
+    g_state.hshift          = 0;
+    g_state.mark            = NULL;
+    g_state.redraw          = REDRAW_ALL;
+    g_state.run.pid         = -1;
+    g_state.run.in          = -1;
+    g_state.run.out         = -1;
+    g_state.run_status      = 0;
+    g_state.running         = 0;
+    g_state.run_id          = 0;
+    g_state.endmark_len     = 0;
+    g_state.check.pid       = -1;
+    g_state.check.in        = -1;
+    g_state.check.out       = -1;
+    g_state.check_hash      = 0;
+    g_state.check_due       = CHECK_DELAY_MS? now_ms(): 0;
+    g_state.err_line        = 0;
+    g_state.nreap           = 0;
+    g_state.child_wake[0]   = -1;
+    g_state.child_wake[1]   = -1;
+    g_state.show_output     = 0;
+    g_state.pane_h          = 0;
     g_state.execute_on_exit = 0;
+    ring_init(&g_state.output, OUTPUT_RING_SIZE);
+    undo_init(&g_state.undo, UNDO_LOG_SIZE);
+    g_state.journal.fd      = -1;
 }
 
+static void run_stop();
+static void check_stop();
+
 static void
 state_cleanup()
 {
+    run_stop();
+    check_stop();
     linelist_free(g_state.lines);
+    load_free(&g_state.load);
+    ring_free(&g_state.output);
+    undo_free(&g_state.undo);
+    history_free(&g_state.history);
+    search_free(&g_state.search);
+    free(g_state.paste);
+}
+
+/* lines from..to changed, SIZE_MAX as to means up to the end */
+static void
+mark_dirty(size_t from, size_t to)
+{
+    if (!(g_state.redraw & REDRAW_LINES)) {
+        g_state.dirty_from = from;
+        g_state.dirty_to   = to;
+        g_state.redraw    |= REDRAW_LINES;
+        return;
+    }
+
+    if (from < g_state.dirty_from) g_state.dirty_from = from;
+    if (to   > g_state.dirty_to)   g_state.dirty_to   = to;
+}
+
+static int
+valid_char(int ch)
+{
+    /* printable ascii symbols */
+    return ch >= 32 && ch <= 126;
+}
+
+/* marked block bounds as line numbers, 0 if there is no block */
+static int
+block_range(size_t *from, size_t *to)
+{
+    size_t m;
+
+    if (!g_state.mark) return 0;
+
+    m     = linelist_index(g_state.lines, g_state.mark);
+    *from = m < g_state.ln? m: g_state.ln;
+    *to   = m < g_state.ln? g_state.ln: m;
+
+    return 1;
+}
+
+static void
+draw_line(Line *l, size_t y, size_t tw, uintattr_t text_fg)
+{
+    size_t hshift = g_state.hshift, x;
+    size_t end    = l->len < hshift + tw? l->len: hshift + tw;
+
+    if (l == g_state.cl) {
+        for (x = hshift; x < end; x++) {
+            uintattr_t fg = text_fg, bg = TB_DEFAULT;
+
+            if (x == g_state.cp) {
+                fg = TB_BLACK;
+                bg = ACCENT_COLOR;
+            }
+
+            tb_set_cell(x-hshift, y, line_at(l, x), fg, bg);
+        }
+
+        if (g_state.cp == l->len)
+            tb_set_cell(l->len-hshift, y, ' ',
+                    TB_BLACK, ACCENT_COLOR);
+    } else {
+        for (x = hshift; x < end; x++)
+            tb_set_cell(x-hshift, y, line_at(l, x),
+                    text_fg, TB_DEFAULT);
+    }
+}
+
+static void
+clear_row(size_t y, size_t tw)
+{
+    size_t x;
+
+    for (x = 0; x < tw; x++)
+        tb_set_cell(x, y, ' ', TB_DEFAULT, TB_DEFAULT);
+}
+
+/* output pane: title row, then the tail of the run output */
+static void
+draw_output(size_t y0, size_t h, size_t tw)
+{
+    Ring   *out = &g_state.output;
+    size_t end  = out->len, i, x, y;
+    int    st   = g_state.run_status;
+
+    clear_row(y0, tw);
+    for (x = 0; x < tw; x++)
+        tb_set_cell(x, y0, ' ', TB_BLACK, ACCENT_COLOR);
+
+    if (g_state.running)
+        tb_printf(0, y0, TB_BLACK, ACCENT_COLOR, " output: running");
+    else if (WIFSIGNALED(st))
+        tb_printf(0, y0, TB_BLACK, ACCENT_COLOR, " output: signal %d",
+                WTERMSIG(st));
+    else
+        tb_printf(0, y0, TB_BLACK, ACCENT_COLOR, " output: exit %d",
+                WEXITSTATUS(st));
+
+    /* find where the last h-1 lines start */
+    if (end && ring_at(out, end-1) == '\n')
+        end--;
+    for (i = end, y = 1; i > 0; i--)
+        if (ring_at(out, i-1) == '\n' && ++y == h)
+            break;
+
+    for (y = y0 + 1; y < y0 + h; y++) {
+        clear_row(y, tw);
+
+        for (x = 0; i < end && ring_at(out, i) != '\n'; i++) {
+            char ch = ring_at(out, i);
+
+            if (ch == '\t')
+                ch = ' ';
+            if (ch < 32 || ch > 126 || x >= tw)
+                continue;
+
+            tb_set_cell(x++, y, ch, TB_DEFAULT, TB_DEFAULT);
+        }
+        i++;
+    }
+}
+
+/* entries in the browser, all of them newest first or search hits */
+static size_t
+browse_count()
+{
+    return g_state.searching? g_state.search.ntop: g_state.history.count;
+}
+
+static size_t
+browse_id(size_t i)
+{
+    return g_state.searching? g_state.search.top[i].id:
+        g_state.history.count - 1 - i;
+}
+
+/* history browser over the text rows */
+static void
+draw_history(size_t rows, size_t tw)
+{
+    History *h = &g_state.history;
+    size_t  y;
+
+    if (g_state.hist_sel < g_state.hist_top)
+        g_state.hist_top = g_state.hist_sel;
+    if (g_state.hist_sel >= g_state.hist_top + rows)
+        g_state.hist_top = g_state.hist_sel - rows + 1;
+
+    for (y = 0; y < rows; y++) {
+        size_t        i = g_state.hist_top + y, x, n;
+        const HistRec *rec;
+        const char    *text;
+        uintattr_t    fg = TB_DEFAULT, bg = TB_DEFAULT;
+        char          when[32];
+        time_t        t;
+
+        clear_row(y, tw);
+        if (i >= browse_count()
+                || !(text = history_entry(h, browse_id(i), &rec)))
+            continue;
+
+        if (i == g_state.hist_sel) {
+            fg = TB_BLACK;
+            bg = ACCENT_COLOR;
+            for (x = 0; x < tw; x++)
+                tb_set_cell(x, y, ' ', fg, bg);
+        }
+
+        t = rec->time;
+        n = strftime(when, sizeof(when), "%m-%d %H:%M  ", localtime(&t));
+        tb_print(0, y, fg | TB_BOLD, bg, when);
+
+        for (x = n; x < tw && x - n < rec->len && text[x-n] != '\n'; x++)
+            tb_set_cell(x, y, valid_char(text[x-n])? text[x-n]: ' ',
+                    fg, bg);
+        if (rec->lines > 1)
+            tb_printf(x + 1, y, fg | TB_BOLD, bg, "(+%u)", rec->lines - 1);
+    }
 }
 
 static void
@@ -46,77 +383,1034 @@ draw_screen()
 {
     /* terminal size */
     size_t th     = tb_height(), tw = tb_width();
-    Line   *l     = g_state.lines->head;
+    Line   *l;
     size_t vshift = 0, hshift = 0;
-    size_t x      = 0, y = 0;
-    size_t line   = 0;
+    size_t y      = 0, last;
+    size_t pane_h = 0, rows;
+    size_t b0     = 1, b1 = 0;
+    size_t err    = SIZE_MAX;
 
-    /* clear screen */
-    tb_clear();
+    /* the output pane takes rows above the msgline */
+    if (g_state.show_output && th > OUTPUT_PANE_HEIGHT + 2)
+        pane_h = OUTPUT_PANE_HEIGHT;
+    rows = th - 1 - pane_h;
 
     /* calculate vertical shift for scrolling */
-    for (;l != g_state.cl;line++,l=l->next);
-    if (line > th - 2)
-        vshift = line - th + 2;
+    if (g_state.ln > rows - 1)
+        vshift = g_state.ln - rows + 1;
 
     /* calculate horizontal shift for scrolling */
     if (g_state.cp > tw - 1)
         hshift = g_state.cp - tw + 1;
 
-    l = g_state.lines->head;
+    /* scrolling and layout changes move every row */
+    if (vshift != g_state.vshift || hshift != g_state.hshift
+            || pane_h != g_state.pane_h)
+        g_state.redraw |= REDRAW_ALL;
+
+    /* nothing changed, keep the last frame */
+    if (!g_state.redraw) return;
+
+    /* a pure vertical scroll moves what the terminal already
+     * shows instead of sending every row again */
+    if (vshift != g_state.vshift && hshift == g_state.hshift
+            && pane_h == g_state.pane_h && !g_state.browsing)
+        tb_scroll(0, rows, (int)((long long)vshift - g_state.vshift));
+
+    /* move the cached top line by the scroll distance */
+    if (vshift > g_state.vshift + TOP_WALK_MAX
+            || vshift + TOP_WALK_MAX < g_state.vshift)
+        g_state.top = linelist_at(g_state.lines, vshift);
+    else {
+        for (; g_state.vshift < vshift; g_state.vshift++)
+            g_state.top = g_state.top->next;
+        for (; g_state.vshift > vshift; g_state.vshift--)
+            g_state.top = g_state.top->prev;
+    }
+    g_state.vshift = vshift;
+    g_state.hshift = hshift;
+    g_state.pane_h = pane_h;
+
+    /* only lines above the pane and msgline are visible */
+    last = vshift + rows - 1;
+
+    block_range(&b0, &b1);
+    if (g_state.err_line)
+        err = g_state.err_line <= g_state.lines->count?
+            g_state.err_line - 1: g_state.lines->count - 1;
+#define LINE_FG(n) ((n) == err? CHECK_ERROR_COLOR: \
+        (n) >= b0 && (n) <= b1? ACCENT_COLOR: TB_DEFAULT)
+
+    if (g_state.browsing) {
+        if (g_state.redraw & (REDRAW_LINES | REDRAW_ALL))
+            draw_history(rows, tw);
+    } else if (g_state.redraw & REDRAW_ALL) {
+        tb_clear();
+
+        for (l = g_state.top; l && y < rows; l = l->next, y++)
+            draw_line(l, y, tw, LINE_FG(vshift + y));
+    } else if (g_state.redraw & REDRAW_LINES
+            && g_state.dirty_to >= vshift && g_state.dirty_from <= last) {
+        size_t from = g_state.dirty_from > vshift? g_state.dirty_from: vshift;
+        size_t to   = g_state.dirty_to < last? g_state.dirty_to: last;
+
+        for (l = g_state.top; l && y < from - vshift; l = l->next, y++);
+
+        /* rows past the end of the list are cleared too */
+        for (; y <= to - vshift; y++) {
+            clear_row(y, tw);
+            if (l) {
+                draw_line(l, y, tw, LINE_FG(vshift + y));
+                l = l->next;
+            }
+        }
+    }
+#undef LINE_FG
 
-    for (;l;l=l->next,y++) {
+    if (pane_h && g_state.redraw & (REDRAW_OUTPUT | REDRAW_ALL))
+        draw_output(rows, pane_h, tw);
 
-        if (y < vshift) continue;
+    /* print msgline */
+    if (g_state.redraw & (REDRAW_STATUS | REDRAW_ALL)) {
+        clear_row(th-1, tw);
+        if (g_state.searching)
+            tb_printf(0, th-1, ACCENT_COLOR, TB_DEFAULT,
+                    "search (%u%s): %.*s", g_state.search.matches.len,
+                    g_state.search.running? "+": "",
+                    (int)g_state.query_len, g_state.query);
+        else if (g_state.browsing)
+            tb_printf(0, th-1, ACCENT_COLOR, TB_DEFAULT,
+                    "history %zu/%zu: enter load, esc close",
+                    g_state.history.count? g_state.hist_sel + 1: 0,
+                    g_state.history.count);
+        else if (g_state.hint[0])
+            tb_printf(0, th-1, ACCENT_COLOR, TB_DEFAULT, "%s",
+                    g_state.hint);
+        else if (g_state.err_line)
+            tb_printf(0, th-1, CHECK_ERROR_COLOR, TB_DEFAULT, "%s",
+                    g_state.err_msg);
+        else
+            tb_printf(0, th-1, ACCENT_COLOR, TB_DEFAULT, HELP_TEXT);
+    }
 
-        if (l == g_state.cl) {
-            for (x = hshift; x < l->len; x++) {
-                uintattr_t fg = TB_DEFAULT, bg = TB_DEFAULT;
+    g_state.redraw = 0;
 
-                if (x == g_state.cp) {
-                    fg = TB_BLACK;
-                    bg = ACCENT_COLOR;
-                }
+    /* draw screen */
+    tb_present();
+}
 
-                tb_set_cell(x-hshift, y-vshift, l->buf[x], fg, bg);
-            }
+/* wakes the poll loop when a child exits */
+static void
+on_sigchld(int sig)
+{
+    int     saved = errno;
+    ssize_t n     = write(g_state.child_wake[1], "", 1);
+
+    UNUSED(sig);
+    UNUSED(n);
+    errno = saved;
+}
+
+/* send SIGTERM and leave the child to reap_poll, so one that ignores
+ * it or keeps running doesn't hold up the editor */
+static void
+reap_add(pid_t pid)
+{
+    kill(pid, SIGTERM);
+
+    if (g_state.nreap == REAP_MAX) {
+        kill(pid, SIGKILL);
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+        return;
+    }
+
+    g_state.reap[g_state.nreap].pid     = pid;
+    g_state.reap[g_state.nreap].kill_at = now_ms() + STOP_KILL_MS;
+    g_state.nreap++;
+}
+
+/* reap the stopped children that are gone and SIGKILL the ones past
+ * their time. returns ms until the next kill is due, -1 if none */
+static int
+reap_poll()
+{
+    long long now  = now_ms(), next = -1;
+    size_t    i    = 0;
+
+    while (i < g_state.nreap) {
+        Reap  *r = &g_state.reap[i];
+        pid_t rv;
+
+        while ((rv = waitpid(r->pid, NULL, WNOHANG)) < 0 && errno == EINTR);
+        if (rv) {
+            *r = g_state.reap[--g_state.nreap];
+            continue;
+        }
+
+        if (r->kill_at && now >= r->kill_at) {
+            kill(r->pid, SIGKILL);
+            r->kill_at = 0;
+        }
+        if (r->kill_at && (next < 0 || r->kill_at - now < next))
+            next = r->kill_at - now;
+        i++;
+    }
+
+    return next;
+}
+
+/* at exit, nothing stopped is left behind */
+static void
+reap_flush()
+{
+    while (g_state.nreap) {
+        int left = reap_poll();
+
+        if (g_state.nreap)
+            poll(NULL, 0, left >= 0 && left < 10? left: 10);
+    }
+}
+
+/* a run is over once its shell exits, which can be after it closed
+ * its output. until then this is tried again from the poll loop */
+static void
+run_reap()
+{
+    int st;
+
+    if (!shell_reap(&g_state.run, &st, NULL))
+        return;
+
+    g_state.run_status = st;
+    g_state.running    = 0;
+    g_state.redraw    |= REDRAW_OUTPUT;
+}
+
+static void
+run_finish()
+{
+    shell_close(&g_state.run);
+    g_state.endmark_len = 0;
+
+    free(g_state.run_pending);
+    g_state.run_pending = NULL;
+    run_reap();
+}
+
+static void
+run_stop()
+{
+    if (g_state.run.pid < 0) return;
+
+    reap_add(g_state.run.pid);
+    g_state.run.pid = -1;
+    shell_close(&g_state.run);
+    /* the wait status of a shell that SIGTERM took */
+    if (g_state.running)
+        g_state.run_status = SIGTERM;
+    g_state.running     = 0;
+    g_state.endmark_len = 0;
+
+    free(g_state.run_pending);
+    g_state.run_pending = NULL;
+    g_state.redraw     |= REDRAW_OUTPUT;
+}
+
+/* send data to the shell, queueing what the pipe doesn't take now */
+static void
+run_send(const char *data, size_t n)
+{
+    size_t  len = g_state.run_pending_len - g_state.run_pending_off;
+    ssize_t w   = 0;
+
+    if (!g_state.run_pending) {
+        len = 0;
+        if ((w = write(g_state.run.in, data, n)) < 0)
+            w = 0;
+        if ((size_t)w == n) return;
+    }
+
+    /* compact the queue and append the rest */
+    if (g_state.run_pending_off)
+        memmove(g_state.run_pending,
+                &g_state.run_pending[g_state.run_pending_off], len);
+
+    g_state.run_pending = realloc(g_state.run_pending, len + n - w);
+    if (!g_state.run_pending)
+        die("realloc run queue err\n");
+
+    memcpy(&g_state.run_pending[len], data + w, n - w);
+    g_state.run_pending_len = len + n - w;
+    g_state.run_pending_off = 0;
+}
+
+/* start lines from..to in the background, its output goes to the
+ * output pane. a run still going is stopped first */
+static void
+run_start(Line *from, Line *to)
+{
+    size_t sent;
+
+    if (!g_state.coproc || g_state.running)
+        run_stop();
+
+    ring_clear(&g_state.output);
+    g_state.show_output = 1;
+    g_state.redraw     |= REDRAW_OUTPUT;
+
+    if (g_state.run.pid < 0) {
+        if (shell_spawn(&g_state.run, SHELL_COMMAND, NULL,
+                    SHELL_STDIN | SHELL_CAPTURE) < 0) {
+            static const char err[] = "can't start " SHELL_COMMAND "\n";
+
+            ring_write(&g_state.output, err, sizeof(err)-1);
+            g_state.run_status = 127 << 8;
+            return;
+        }
+
+        fcntl(g_state.run.in, F_SETFL, O_NONBLOCK);
+        fcntl(g_state.run.out, F_SETFL, O_NONBLOCK);
+    }
+
+    g_state.running = 1;
+
+    /* send what the pipe takes right now, the rest is copied because
+     * the lines may be edited before the shell reads them */
+    if (linelist_write(from, to, g_state.run.in, &sent) < 0
+            && errno == EAGAIN) {
+        g_state.run_pending     = linelist_dump(from, to, sent,
+                &g_state.run_pending_len);
+        g_state.run_pending_off = 0;
+    }
+
+    if (g_state.coproc) {
+        char mark[64];
+        int  n = snprintf(mark, sizeof(mark),
+                "printf '\\036ice %u %%d\\036' \"$?\"\n",
+                ++g_state.run_id);
+
+        run_send(mark, n);
+    } else if (!g_state.run_pending) {
+        close(g_state.run.in);
+        g_state.run.in = -1;
+    }
+}
+
+static void
+run_feed()
+{
+    ssize_t n = write(g_state.run.in,
+            &g_state.run_pending[g_state.run_pending_off],
+            g_state.run_pending_len - g_state.run_pending_off);
+
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    if (n > 0) {
+        g_state.run_pending_off += n;
+        if (g_state.run_pending_off < g_state.run_pending_len)
+            return;
+    }
+
+    /* all sent or the shell is gone, a coprocess
+     * keeps its stdin for the next run */
+    if (n < 0 || !g_state.coproc) {
+        close(g_state.run.in);
+        g_state.run.in = -1;
+    }
+    free(g_state.run_pending);
+    g_state.run_pending = NULL;
+}
 
-            if (g_state.cp == l->len)
-                tb_set_cell(l->len-hshift, y-vshift, ' ',
-                        TB_BLACK, ACCENT_COLOR);
+static void
+run_mark(const char *text, size_t n)
+{
+    unsigned id;
+    int      code;
+    char     buf[RUN_MARK_MAX+1];
+
+    memcpy(buf, text, n);
+    buf[n] = 0;
+
+    if (sscanf(buf, "ice %u %d", &id, &code) == 2
+            && id == g_state.run_id) {
+        g_state.run_status = (code & 0xff) << 8;
+        g_state.running    = 0;
+        return;
+    }
+
+    /* not ours, it's output */
+    ring_write(&g_state.output, RUN_MARK_STR, 1);
+    ring_write(&g_state.output, text, n);
+    ring_write(&g_state.output, RUN_MARK_STR, 1);
+}
+
+/* pass output to the pane, picking coprocess end markers out of it.
+ * a marker may be split over several reads */
+static void
+run_output(const char *buf, size_t n)
+{
+    size_t i, start = 0;
+
+    if (!g_state.coproc) {
+        ring_write(&g_state.output, buf, n);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (!g_state.endmark_len) {
+            if (buf[i] == RUN_MARK) {
+                ring_write(&g_state.output, &buf[start], i - start);
+                g_state.endmark[g_state.endmark_len++] = buf[i];
+            }
+        } else if (buf[i] == RUN_MARK) {
+            run_mark(&g_state.endmark[1], g_state.endmark_len - 1);
+            g_state.endmark_len = 0;
+            start = i + 1;
+        } else if (g_state.endmark_len < RUN_MARK_MAX) {
+            g_state.endmark[g_state.endmark_len++] = buf[i];
         } else {
-            for (x = hshift; x < l->len; x++)
-                tb_set_cell(x-hshift, y-vshift, l->buf[x],
-                        TB_DEFAULT, TB_DEFAULT);
+            /* too long for a marker */
+            ring_write(&g_state.output, g_state.endmark,
+                    g_state.endmark_len);
+            g_state.endmark_len = 0;
+            start = i;
         }
     }
 
-    /* print msgline */
-    for (x = 0; x < tw; ++x)
-        tb_set_cell(x, th-1, ' ', TB_DEFAULT, TB_DEFAULT);
-    tb_printf(0, th-1, ACCENT_COLOR, TB_DEFAULT, HELP_TEXT);
+    if (!g_state.endmark_len)
+        ring_write(&g_state.output, &buf[start], n - start);
+}
 
-    /* draw screen */
-    tb_present();
+static void
+run_read()
+{
+    char    buf[4096];
+    ssize_t n = read(g_state.run.out, buf, sizeof(buf));
+
+    if (n > 0) {
+        run_output(buf, n);
+        g_state.redraw |= REDRAW_OUTPUT;
+    } else if (!n || (errno != EAGAIN && errno != EINTR)) {
+        run_finish();
+    }
+}
+
+static void
+check_stop()
+{
+    if (g_state.check.pid >= 0) {
+        reap_add(g_state.check.pid);
+        g_state.check.pid = -1;
+    }
+    shell_close(&g_state.check);
+
+    free(g_state.check_buf);
+    g_state.check_buf = NULL;
+}
+
+static void
+check_feed()
+{
+    ssize_t n = write(g_state.check.in,
+            &g_state.check_buf[g_state.check_off],
+            g_state.check_len - g_state.check_off);
+
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    if (n > 0) {
+        g_state.check_off += n;
+        if (g_state.check_off < g_state.check_len)
+            return;
+    }
+
+    close(g_state.check.in);
+    g_state.check.in = -1;
+    free(g_state.check_buf);
+    g_state.check_buf = NULL;
+}
+
+/* start SHELL_COMMAND -n on a copy of the buffer, unless the last
+ * check (finished or not) already saw this content */
+static void
+check_start()
+{
+    uint64_t h = 14695981039346656037ULL;
+    size_t   len, i;
+    char     *buf;
+
+    buf = linelist_dump(g_state.lines->head, NULL, 0, &len);
+    for (i = 0; i < len; i++)
+        h = (h ^ (unsigned char)buf[i]) * 1099511628211ULL;
+
+    if (h == g_state.check_hash) {
+        free(buf);
+        return;
+    }
+
+    check_stop();
+    g_state.check_hash    = h;
+    g_state.check_out_len = 0;
+
+    if (shell_spawn(&g_state.check, SHELL_COMMAND, "-n",
+                SHELL_STDIN | SHELL_CAPTURE) < 0) {
+        free(buf);
+        return;
+    }
+
+    fcntl(g_state.check.in, F_SETFL, O_NONBLOCK);
+    fcntl(g_state.check.out, F_SETFL, O_NONBLOCK);
+
+    g_state.check_buf = buf;
+    g_state.check_len = len;
+    g_state.check_off = 0;
+    check_feed();
+}
+
+/* the line number from "sh: 3: ..." or "bash: line 3: ..." */
+static size_t
+check_lineno(const char *msg)
+{
+    const char *p;
+
+    for (p = msg; *p; p++) {
+        if (*p < '0' || *p > '9')
+            continue;
+
+        if ((p - msg >= 5 && !strncmp(p-5, "line ", 5))
+                || (p - msg >= 2 && !strncmp(p-2, ": ", 2))) {
+            char   *end;
+            size_t n = strtoul(p, &end, 10);
+
+            if (*end == ':') return n;
+        }
+
+        while (p[1] >= '0' && p[1] <= '9') p++;
+    }
+
+    return 0;
 }
 
+/* the verdict is in once the shell exits, which can be after it
+ * closed its output. until then this is tried again from the loop */
+static void
+check_reap()
+{
+    size_t old = g_state.err_line, i;
+    int    st;
+
+    if (!shell_reap(&g_state.check, &st, NULL))
+        return;
+
+    /* first line of the complaint, printable only */
+    for (i = 0; i < g_state.check_out_len
+            && g_state.check_out[i] != '\n'; i++) {
+        char ch = g_state.check_out[i];
+
+        g_state.err_msg[i] = ch >= 32 && ch <= 126? ch: ' ';
+    }
+    g_state.err_msg[i] = 0;
+
+    g_state.err_line = 0;
+    if (WIFEXITED(st) && WEXITSTATUS(st)) {
+        g_state.err_line = check_lineno(g_state.err_msg);
+        if (!g_state.err_line)
+            g_state.err_line = 1;
+    }
+
+    if (old == g_state.err_line)
+        return;
+
+    if (old)              mark_dirty(old - 1, old - 1);
+    if (g_state.err_line) mark_dirty(g_state.err_line - 1,
+                                     g_state.err_line - 1);
+    /* a line past the end shows on the last one */
+    if ((old > g_state.lines->count) ||
+            g_state.err_line > g_state.lines->count)
+        mark_dirty(g_state.lines->count - 1, g_state.lines->count - 1);
+    g_state.redraw |= REDRAW_STATUS;
+}
+
+static void
+check_finish()
+{
+    shell_close(&g_state.check);
+
+    free(g_state.check_buf);
+    g_state.check_buf = NULL;
+    check_reap();
+}
+
+static void
+check_read()
+{
+    char    buf[1024], *dst = buf;
+    size_t  room = CHECK_OUT_MAX - 1 - g_state.check_out_len;
+    ssize_t n;
+
+    /* keep the start, drain the rest */
+    if (room)
+        dst = &g_state.check_out[g_state.check_out_len];
+    n = read(g_state.check.out, dst, room? room: sizeof(buf));
+
+    if (n > 0) {
+        if (room) g_state.check_out_len += n;
+    } else if (!n || (errno != EAGAIN && errno != EINTR)) {
+        check_finish();
+    }
+}
+
+/* termbox hook for escape sequences it doesn't know. the raw input
+ * is only reachable through termbox internals, which TB_IMPL exposes
+ * to this file */
 static int
-valid_char(int ch)
+extract_paste(struct tb_event *ev, size_t *consumed)
 {
-    /* printable ascii symbols */
-    return ch >= 32 && ch <= 126;
+    struct bytebuf *in = &global.in;
+    size_t         n   = in->len < PASTE_MARK_LEN? in->len: PASTE_MARK_LEN;
+
+    if (!memcmp(in->buf, PASTE_BEGIN, n))
+        ev->key = KEY_PASTE_BEGIN;
+    else if (!memcmp(in->buf, PASTE_END, n))
+        ev->key = KEY_PASTE_END;
+    else
+        return TB_ERR;
+
+    if (n < PASTE_MARK_LEN)
+        return TB_ERR_NEED_MORE;
+
+    ev->type  = TB_EVENT_KEY;
+    ev->ch    = 0;
+    ev->mod   = 0;
+    *consumed = PASTE_MARK_LEN;
+
+    return TB_OK;
 }
 
 static int
-handle_events()
+extract_sync_reply(struct tb_event *ev, size_t *consumed)
 {
-    struct tb_event ev;
-    tb_poll_event(&ev);
+    struct bytebuf *in = &global.in;
+    size_t         n   = in->len < SYNC_REPLY_LEN? in->len: SYNC_REPLY_LEN;
+    size_t         i;
+    uint32_t       mode = 0;
+
+    if (memcmp(in->buf, SYNC_REPLY, n))
+        return TB_ERR;
+    if (n < SYNC_REPLY_LEN)
+        return TB_ERR_NEED_MORE;
+
+    for (i = n; i < in->len && i < n + 3
+            && in->buf[i] >= '0' && in->buf[i] <= '9'; i++)
+        mode = mode * 10 + in->buf[i] - '0';
+
+    if (i + 2 > in->len)
+        return TB_ERR_NEED_MORE;
+    if (i == n || in->buf[i] != '$' || in->buf[i+1] != 'y')
+        return TB_ERR;
+
+    ev->type  = TB_EVENT_KEY;
+    ev->key   = KEY_SYNC_REPLY;
+    ev->ch    = mode;
+    ev->mod   = 0;
+    *consumed = i + 2;
+
+    return TB_OK;
+}
+
+static int
+extract_keys(struct tb_event *ev, size_t *consumed)
+{
+    int rv = extract_paste(ev, consumed);
+
+    return rv == TB_ERR? extract_sync_reply(ev, consumed): rv;
+}
+
+static void
+paste_add(const char *text, size_t n)
+{
+    if (g_state.paste_len + n > g_state.paste_cap) {
+        g_state.paste_cap = (g_state.paste_len + n) * 2;
+        g_state.paste     = realloc(g_state.paste, g_state.paste_cap);
+        if (!g_state.paste)
+            die("realloc paste buf err\n");
+    }
+
+    memcpy(&g_state.paste[g_state.paste_len], text, n);
+    g_state.paste_len += n;
+}
+
+/* collect pasted keys, nothing is edited until the paste ends */
+static void
+paste_key(struct tb_event ev)
+{
+    char ch = (char)ev.ch;
+    int  cr = g_state.paste_cr;
+
+    /* \r, \n and \r\n all end a line */
+    g_state.paste_cr = ev.key == TB_KEY_ENTER;
+
+    switch (ev.key) {
+    case TB_KEY_CTRL_J:
+        if (cr) break;
+        /* fallthrough */
+    case TB_KEY_ENTER:
+        paste_add("\n", 1);
+        break;
+
+    case TB_KEY_TAB:
+        {
+            char spaces[TAB_WIDTH];
+
+            memset(spaces, ' ', TAB_WIDTH);
+            paste_add(spaces, TAB_WIDTH);
+            break;
+        }
+
+    default:
+        if (valid_char(ev.ch))
+            paste_add(&ch, 1);
+        break;
+    }
+}
+
+/* every change to the list goes through edit_insert and edit_delete,
+ * they keep the cursor, the view and the undo log in step with it.
+ * line is line number ln, the cursor ends up after inserted text and
+ * where deleted text was */
+static void
+edit_insert(Line *line, size_t ln, size_t pos, const char *text, size_t n,
+        int record)
+{
+    const char *p = text, *end = text + n;
+    size_t     lines = 0;
+
+    while ((p = memchr(p, '\n', end - p))) {
+        lines++;
+        p++;
+    }
+
+    g_state.edits++;
+    if (record)
+        undo_record(&g_state.undo, UNDO_INSERT, ln, pos, text, n);
+    journal_record(&g_state.journal, UNDO_INSERT, ln, pos, text, n);
+
+    g_state.cl = linelist_splice(g_state.lines, line, pos, text, n,
+            &g_state.cp);
+    g_state.ln = ln + lines;
+
+    /* new lines go after line, top moves down when that's above it */
+    if (ln < g_state.vshift)
+        g_state.vshift += lines;
+
+    mark_dirty(ln, lines? SIZE_MAX: ln);
+}
+
+static void
+edit_delete(Line *line, size_t ln, size_t pos, size_t n, int record)
+{
+    char   small[64], *text = NULL;
+    size_t left = n, avail = line->len - pos, lines = 0;
+    Line   *l;
+
+    /* lines joined into line go away, nothing may point at them */
+    for (l = line; left > avail && l->next; avail = l->len, lines++) {
+        left -= avail + 1;
+        l     = l->next;
+
+        if (g_state.top == l)
+            g_state.top = line;
+        if (g_state.mark == l)
+            g_state.mark = line;
+    }
+
+    /* top moves up with the lines below the joined ones, even when
+     * the cursor left the view in the same batch of events */
+    if (lines && ln < g_state.vshift)
+        g_state.vshift = g_state.vshift > ln + lines?
+            g_state.vshift - lines: ln;
+
+    if (record && !(text = n <= sizeof(small)? small: malloc(n)))
+        die("edit alloc err\n");
+
+    g_state.edits++;
+    linelist_erase(g_state.lines, line, pos, n, text);
+    journal_record(&g_state.journal, UNDO_DELETE, ln, pos, NULL, n);
+
+    if (record) {
+        undo_record(&g_state.undo, UNDO_DELETE, ln, pos, text, n);
+        if (text != small) free(text);
+    }
+
+    g_state.cl = line;
+    g_state.cp = pos;
+    g_state.ln = ln;
+
+    mark_dirty(ln, lines? SIZE_MAX: ln);
+}
+
+/* insert what all n names share past the first plen bytes, plus a
+ * blank after a unique one that isn't a directory. more than one
+ * name are listed in the msgline */
+static void
+complete_insert(char **names, size_t n, size_t plen)
+{
+    size_t len, i, off = 0;
+
+    if (!n) return;
+
+    len = strlen(names[0]);
+    for (i = 1; i < n; i++) {
+        size_t k = plen;
+
+        while (k < len && names[i][k] == names[0][k]) k++;
+        len = k;
+    }
+
+    if (len > plen)
+        edit_insert(g_state.cl, g_state.ln, g_state.cp,
+                &names[0][plen], len - plen, 1);
+
+    if (n == 1 && names[0][len-1] != '/')
+        edit_insert(g_state.cl, g_state.ln, g_state.cp, " ", 1, 1);
+
+    if (n == 1) return;
+
+    for (i = 0; i < n && off + 2 < sizeof(g_state.hint); i++)
+        off += snprintf(&g_state.hint[off], sizeof(g_state.hint) - off,
+                "%s ", names[i]);
+    g_state.redraw |= REDRAW_STATUS;
+}
+
+/* a listing asked for by complete_word came in. it only applies if
+ * nothing moved or changed since */
+static void
+complete_listing()
+{
+    CompList names;
+    unsigned id;
+    size_t   blen = strlen(g_state.comp_base), i, n = 0;
+
+    if (!complete_take(&g_state.comp, &id, &names))
+        return;
+
+    if (id == g_state.comp_id && g_state.edits == g_state.comp_edits
+            && g_state.ln == g_state.comp_ln
+            && g_state.cp == g_state.comp_cp) {
+        /* hidden files only when asked for */
+        for (i = 0; i < names.n; i++)
+            if (!strncmp(names.v[i], g_state.comp_base, blen)
+                    && (names.v[i][0] != '.' || g_state.comp_base[0] == '.'))
+                names.v[n++] = names.v[i];
+            else
+                free(names.v[i]);
+        names.n = n;
+
+        complete_insert(names.v, names.n, blen);
+    }
+
+    complist_free(&names);
+}
+
+/* tab on the word left of the cursor: the first word of a command
+ * completes from PATH, anything else as a path. 0 if there is no
+ * word, tab inserts blanks then */
+static int
+complete_word()
+{
+    Line   *l = g_state.cl;
+    size_t cp = g_state.cp, start = cp, i, n;
+    char   word[256], dir[4096], *slash;
+
+    while (start && line_at(l, start-1) != ' ' && cp - start < 200)
+        start--;
+    if (start == cp) return 0;
+
+    for (n = 0, i = start; i < cp; i++)
+        word[n++] = line_at(l, i);
+    word[n] = 0;
+
+    /* only blanks or a separator before it */
+    for (i = start; i && line_at(l, i-1) == ' '; i--);
+    if ((!i || strchr("|;&(", line_at(l, i-1))) && !strchr(word, '/')) {
+        size_t first, count;
+
+        if (!complete_commands(&g_state.comp, word, n, &first, &count)) {
+            snprintf(g_state.hint, sizeof(g_state.hint),
+                    "reading PATH...");
+            g_state.redraw |= REDRAW_STATUS;
+        } else {
+            complete_insert(&g_state.comp.cmds.v[first], count, n);
+        }
+        return 1;
+    }
+
+    /* dir part as the shell would see it, ~/ is $HOME */
+    slash = strrchr(word, '/');
+    if (!slash)
+        snprintf(dir, sizeof(dir), ".");
+    else if (word[0] == '~' && word[1] == '/')
+        snprintf(dir, sizeof(dir), "%s%.*s", getenv("HOME")?
+                getenv("HOME"): "", (int)(slash - word), word + 1);
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - word + 1), word);
+
+    snprintf(g_state.comp_base, sizeof(g_state.comp_base), "%s",
+            slash? slash + 1: word);
+    g_state.comp_ln    = g_state.ln;
+    g_state.comp_cp    = g_state.cp;
+    g_state.comp_edits = g_state.edits;
+    complete_dir(&g_state.comp, dir, ++g_state.comp_id);
+
+    return 1;
+}
+
+/* replace the buffer with the selected history entry,
+ * as two edits so undo brings the old one back */
+static void
+history_load()
+{
+    History       *h = &g_state.history;
+    const HistRec *rec;
+    const char    *text;
+    size_t        total = 0;
+    Line          *l;
+
+    if (g_state.hist_sel >= browse_count()
+            || !(text = history_entry(h, browse_id(g_state.hist_sel), &rec)))
+        return;
+
+    for (l = g_state.lines->head; l; l = l->next)
+        total += l->len + 1;
+
+    g_state.mark = NULL;
+    edit_delete(g_state.lines->head, 0, 0, total - 1, 1);
+    edit_insert(g_state.lines->head, 0, 0, text, rec->len - 1, 1);
+}
+
+static void
+history_key(struct tb_event ev)
+{
+    size_t count = browse_count();
+    size_t page  = tb_height() > 2? tb_height() - 2: 1;
+
+    switch (ev.key) {
+    case TB_KEY_BACKSPACE:  /* fallthrough */
+    case TB_KEY_BACKSPACE2:
+        if (g_state.searching && g_state.query_len) {
+            g_state.query_len--;
+            search_query(&g_state.search, g_state.query,
+                    g_state.query_len);
+            g_state.hist_sel = 0;
+        }
+        break;
+
+    case TB_KEY_ARROW_UP:
+        if (g_state.hist_sel) g_state.hist_sel--;
+        break;
+
+    case TB_KEY_ARROW_DOWN:
+        if (g_state.hist_sel + 1 < count) g_state.hist_sel++;
+        break;
+
+    case TB_KEY_PGUP:
+        g_state.hist_sel = g_state.hist_sel > page?
+            g_state.hist_sel - page: 0;
+        break;
+
+    case TB_KEY_PGDN:
+        g_state.hist_sel = g_state.hist_sel + page < count?
+            g_state.hist_sel + page: (count? count - 1: 0);
+        break;
+
+    case TB_KEY_ENTER:
+        history_load();
+        /* fallthrough */
+    case TB_KEY_ESC:  /* fallthrough */
+    case KEY_SEARCH:  /* fallthrough */
+    case KEY_HISTORY:
+        g_state.browsing  = 0;
+        g_state.searching = 0;
+        break;
+
+    default:
+        /* typing refines the search */
+        if (g_state.searching && valid_char(ev.ch)
+                && g_state.query_len < SEARCH_QUERY_MAX) {
+            g_state.query[g_state.query_len++] = (char)ev.ch;
+            search_query(&g_state.search, g_state.query,
+                    g_state.query_len);
+            g_state.hist_sel = 0;
+        }
+        break;
+    }
+
+    g_state.redraw |= REDRAW_ALL;
+}
+
+/* splice the whole paste into the list at once */
+static void
+paste_apply()
+{
+    g_state.pasting = 0;
+    if (!g_state.paste_len) return;
+
+    edit_insert(g_state.cl, g_state.ln, g_state.cp,
+            g_state.paste, g_state.paste_len, 1);
+
+    /* a stray PASTE_END must not insert it again */
+    g_state.paste_len = 0;
+}
+
+static int
+handle_event(struct tb_event ev)
+{
+    size_t ln = g_state.ln, cp = g_state.cp;
+
+    /* 1 and 2 mean the mode is known, set or reset */
+    if (ev.type == TB_EVENT_KEY && ev.key == KEY_SYNC_REPLY) {
+        tb_set_sync_output(ev.ch == 1 || ev.ch == 2);
+        return 0;
+    }
+
+    if (g_state.pasting && ev.type == TB_EVENT_KEY
+            && ev.key != KEY_PASTE_END) {
+        /* exit keys still work when the end of a paste got lost,
+         * what came so far is applied first */
+        if (ev.key != TB_KEY_CTRL_C && ev.key != KEY_EXIT) {
+            paste_key(ev);
+            return 0;
+        }
+        paste_apply();
+    }
+
+    /* a hint stays until the next key */
+    if (g_state.hint[0] && ev.type == TB_EVENT_KEY) {
+        g_state.hint[0] = 0;
+        g_state.redraw |= REDRAW_STATUS;
+    }
+
+    if (g_state.browsing && ev.type == TB_EVENT_KEY) {
+        history_key(ev);
+        return 0;
+    }
 
     /* edit mode events */
     switch (ev.type) {
     case TB_EVENT_KEY:
         switch (ev.key) {
+        case KEY_PASTE_BEGIN:
+            g_state.pasting     = 1;
+            g_state.paste_len   = 0;
+            g_state.paste_cr    = 0;
+            g_state.paste_at    = now_ms();
+            break;
+
+        case KEY_PASTE_END:
+            paste_apply();
+            break;
+
         /* exit */
         case TB_KEY_CTRL_C: /* fallthrough */
         case KEY_EXIT:
@@ -126,6 +1420,73 @@ handle_events()
             g_state.execute_on_exit = 1;
             return 1;
 
+        case KEY_RUN:
+            history_add(&g_state.history, g_state.lines->head, NULL);
+            run_start(g_state.lines->head, NULL);
+            break;
+
+        case KEY_HISTORY: /* fallthrough */
+        case KEY_SEARCH:
+            history_map(&g_state.history);
+            g_state.browsing  = 1;
+            g_state.searching = ev.key == KEY_SEARCH;
+            g_state.hist_sel  = 0;
+            g_state.hist_top  = 0;
+            g_state.redraw   |= REDRAW_ALL;
+
+            if (g_state.searching) {
+                search_index(&g_state.search, &g_state.history);
+                search_query(&g_state.search, g_state.query,
+                        g_state.query_len);
+            }
+            break;
+
+        case KEY_RUN_BLOCK:
+            {
+                size_t from, to;
+
+                if (block_range(&from, &to))
+                    run_start(g_state.ln == from? g_state.cl: g_state.mark,
+                            g_state.ln == from? g_state.mark: g_state.cl);
+                else
+                    run_start(g_state.cl, g_state.cl);
+                break;
+            }
+
+        case KEY_MARK:
+            {
+                size_t from, to;
+
+                if (!block_range(&from, &to))
+                    from = to = g_state.ln;
+                mark_dirty(from, to);
+
+                g_state.mark = g_state.mark? NULL: g_state.cl;
+                break;
+            }
+
+        case KEY_TOGGLE_OUTPUT:
+            g_state.show_output = !g_state.show_output;
+            break;
+
+        case KEY_UNDO: /* fallthrough */
+        case KEY_REDO:
+            {
+                UndoOp op;
+                Line   *line;
+
+                if (!(ev.key == KEY_UNDO? undo_undo: undo_redo)(
+                            &g_state.undo, &op))
+                    break;
+
+                line = linelist_at(g_state.lines, op.line);
+                if (op.type == UNDO_INSERT)
+                    edit_insert(line, op.line, op.col, op.text, op.len, 0);
+                else
+                    edit_delete(line, op.line, op.col, op.len, 0);
+                break;
+            }
+
         /* delete left symbol */
         case TB_KEY_BACKSPACE:  /* fallthrough */
         case TB_KEY_BACKSPACE2: /* fallthrough */
@@ -135,95 +1496,44 @@ handle_events()
                 Line *cur = g_state.cl;
 
                 if (g_state.cp > 0) {
-                    if (ev.key == TB_KEY_CTRL_W) {
-                        size_t pos = g_state.cp, delete_len;
+                    size_t pos = g_state.cp - 1;
 
+                    if (ev.key == TB_KEY_CTRL_W) {
+                        pos = g_state.cp;
                         /* del spaces */
-                        while (pos && cur->buf[pos-1] == ' ') pos--;
+                        while (pos && line_at(cur, pos-1) == ' ') pos--;
                         /* del word */
-                        while (pos && cur->buf[pos-1] != ' ') pos--;
-
-                        delete_len = g_state.cp - pos;
-                        if (delete_len > 0) {
-                            memmove(&cur->buf[pos],
-                                    &cur->buf[g_state.cp],
-                                    cur->len-g_state.cp+1);
-
-                            g_state.cp = pos;
-                            cur->len -= delete_len;
-                        }
-                    } else {
-                        memmove(&cur->buf[g_state.cp-1],
-                                &cur->buf[g_state.cp],
-                                cur->len-g_state.cp+1);
-                        g_state.cp--;
-                        cur->len--;
+                        while (pos && line_at(cur, pos-1) != ' ') pos--;
                     }
+
+                    edit_delete(cur, g_state.ln, pos, g_state.cp - pos, 1);
                 } else if (cur->prev) {
                     /* merge lines case */
-                    Line   *prev  = cur->prev;
-                    size_t newlen = prev->len + cur->len;
-
-                    if (newlen+1 >= prev->cap) {
-                        prev->cap = (newlen+1)*2;
-                        prev->buf = realloc(prev->buf,
-                                prev->cap);
-                        if (!prev->buf)
-                            die("realloc line buf err\n");
-                    }
-
-                    strcat(prev->buf, cur->buf);
-
-                    prev->len  = newlen;
-                    g_state.cl = prev;
-                    g_state.cp = prev->len-cur->len;
-
-                    linelist_remove(g_state.lines, cur);
+                    edit_delete(cur->prev, g_state.ln - 1,
+                            cur->prev->len, 1, 1);
                 }
 
                 break;
             }
 
-        /* insert TAB_WIDTH spaces on tab */
+        /* complete, or insert TAB_WIDTH spaces */
         case TB_KEY_TAB:
             {
-                Line *cur = g_state.cl;
-
-                if (cur->len + TAB_WIDTH >= cur->cap) {
-                    cur->cap = (cur->len + TAB_WIDTH) * 2;
-                    cur->buf = realloc(cur->buf, cur->cap);
-                    if (!cur->buf)
-                        die("realloc line buf err\n");
-                }
+                char spaces[TAB_WIDTH];
 
-                memmove(&cur->buf[g_state.cp+TAB_WIDTH],
-                        &cur->buf[g_state.cp],
-                        cur->len-g_state.cp+1);
+                if (complete_word())
+                    break;
 
-                memset(&cur->buf[g_state.cp], ' ', TAB_WIDTH);
-
-                cur->len   += TAB_WIDTH;
-                g_state.cp += TAB_WIDTH;
+                memset(spaces, ' ', TAB_WIDTH);
+                edit_insert(g_state.cl, g_state.ln, g_state.cp,
+                        spaces, TAB_WIDTH, 1);
                 break;
             }
 
         /* move line */
         case TB_KEY_ENTER:
-            {
-                Line *cur          = g_state.cl;
-                char *after_cursor = &cur->buf[g_state.cp];
-                Line *newline      = linelist_insert_after(
-                        g_state.lines,
-                        cur,
-                        after_cursor);
-
-                cur->buf[g_state.cp] = 0;
-                cur->len             = g_state.cp;
-                g_state.cl           = newline;
-                g_state.cp           = 0;
-
-                break;
-            }
+            edit_insert(g_state.cl, g_state.ln, g_state.cp, "\n", 1, 1);
+            break;
 
         case TB_KEY_ARROW_LEFT:
             if (g_state.cp > 0) {
@@ -231,9 +1541,9 @@ handle_events()
                     Line   *cur = g_state.cl;
                     size_t pos  = g_state.cp;
                     /* skip spaces */
-                    while (pos && cur->buf[pos-1] == ' ') pos--;
+                    while (pos && line_at(cur, pos-1) == ' ') pos--;
                     /* skip word */
-                    while (pos && cur->buf[pos-1] != ' ') pos--;
+                    while (pos && line_at(cur, pos-1) != ' ') pos--;
                     g_state.cp = pos;
                 } else {
                     g_state.cp--;
@@ -241,6 +1551,7 @@ handle_events()
             } else if (g_state.cl->prev) {
                 g_state.cl = g_state.cl->prev;
                 g_state.cp = g_state.cl->len;
+                g_state.ln--;
             }
             break;
 
@@ -250,9 +1561,9 @@ handle_events()
                     Line   *cur = g_state.cl;
                     size_t pos  = g_state.cp;
                     /* skip word */
-                    while (pos < cur->len && cur->buf[pos] != ' ') pos++;
+                    while (pos < cur->len && line_at(cur, pos) != ' ') pos++;
                     /* skip spaces */
-                    while (pos < cur->len && cur->buf[pos] == ' ') pos++;
+                    while (pos < cur->len && line_at(cur, pos) == ' ') pos++;
                     g_state.cp = pos;
                 } else {
                     g_state.cp++;
@@ -260,12 +1571,14 @@ handle_events()
             } else if (g_state.cl->next) {
                 g_state.cl = g_state.cl->next;
                 g_state.cp = 0;
+                g_state.ln++;
             }
             break;
 
         case TB_KEY_ARROW_UP:
             if (g_state.cl->prev) {
                 g_state.cl = g_state.cl->prev;
+                g_state.ln--;
                 if (g_state.cp > g_state.cl->len)
                     g_state.cp = g_state.cl->len;
             }
@@ -274,6 +1587,7 @@ handle_events()
         case TB_KEY_ARROW_DOWN:
             if (g_state.cl->next) {
                 g_state.cl = g_state.cl->next;
+                g_state.ln++;
                 if (g_state.cp > g_state.cl->len)
                     g_state.cp = g_state.cl->len;
             }
@@ -282,67 +1596,276 @@ handle_events()
         default:
             /* insert symbol */
             if (valid_char(ev.ch)) {
-                Line *line = g_state.cl;
+                char ch = (char)ev.ch;
 
-                if (line->len + 1 == line->cap) {
-                    line->cap = (line->len + 1) * 2;
-                    line->buf = realloc(line->buf, line->cap);
-                    if (!line->buf)
-                        die("realloc line buf err\n");
-                }
-
-                memmove(&line->buf[g_state.cp+1],
-                        &line->buf[g_state.cp],
-                        line->len-g_state.cp+1);
-
-                line->buf[g_state.cp] = (char)ev.ch;
-                line->len++;
-                g_state.cp++;
+                edit_insert(g_state.cl, g_state.ln, g_state.cp, &ch, 1, 1);
             }
             break;
         }
         break;
+
+    case TB_EVENT_RESIZE:
+        g_state.redraw |= REDRAW_ALL;
+        break;
     }
 
+    /* every in-line edit moves the cursor,
+     * so old and new cursor lines cover them */
+    if (ln < g_state.ln)
+        mark_dirty(ln, g_state.ln);
+    else if (ln > g_state.ln || cp != g_state.cp)
+        mark_dirty(g_state.ln, ln);
+
     return 0;
 }
 
-static void
+/* apply the input termbox has ready. a batch stops after
+ * INPUT_BATCH_MS so the screen keeps updating, more is set then */
+static int
+handle_events(int *more)
+{
+    struct tb_event ev;
+    long long       start = now_ms();
+
+    *more = 0;
+
+    while (tb_peek_event(&ev, 0) == TB_OK) {
+        if (handle_event(ev)) return 1;
+
+        /* recheck once typing pauses */
+        if (CHECK_DELAY_MS)
+            g_state.check_due = now_ms() + CHECK_DELAY_MS;
+
+        if (!g_state.pasting && now_ms() - start >= INPUT_BATCH_MS) {
+            *more = 1;
+            break;
+        }
+    }
+
+    if (g_state.pasting)
+        g_state.paste_at = now_ms();
+
+    return 0;
+}
+
+/* 1 if the user quit, 0 if the terminal went away */
+static int
 tui_loop()
 {
+    struct pollfd    fds[8];
+    struct sigaction sa = {0};
+    int              ttyfd = -1, resizefd = -1, more = 0, quit = 0, i;
+    int              rv;
+
     /* init termbox */
-    tb_init();
+    if ((rv = tb_init()) != TB_OK)
+        die("can't init termbox: %s\n", tb_strerror(rv));
+    tb_set_func(TB_FUNC_EXTRACT_PRE, extract_keys);
+    tb_send(PASTE_ENABLE, sizeof(PASTE_ENABLE)-1);
+    tb_send(SYNC_QUERY, sizeof(SYNC_QUERY)-1);
+    if ((rv = tb_get_fds(&ttyfd, &resizefd)) != TB_OK)
+        die("can't get tty fds: %s\n", tb_strerror(rv));
+
+    /* exited children are reaped from the loop */
+    if (pipe(g_state.child_wake) < 0)
+        die("pipe error\n");
+    for (i = 0; i < 2; i++) {
+        fcntl(g_state.child_wake[i], F_SETFD, FD_CLOEXEC);
+        fcntl(g_state.child_wake[i], F_SETFL, O_NONBLOCK);
+    }
+    sa.sa_handler = on_sigchld;
+    sa.sa_flags   = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
 
     draw_screen();
-    /* main loop */
+    /* main loop, multiplexing the tty and a background run */
     while (1) {
-        if (handle_events()) break;
+        int nfds = 3, out = -1, in = -1, cout = -1, cin = -1, comp = -1;
+        int timeout = more || (g_state.searching && g_state.search.running)?
+            0: -1;
+        int kill_in = reap_poll();
+
+        fds[0].fd     = ttyfd;
+        fds[0].events = POLLIN;
+        fds[1].fd     = resizefd;
+        fds[1].events = POLLIN;
+        fds[2].fd     = g_state.child_wake[0];
+        fds[2].events = POLLIN;
+
+        if (g_state.run.out >= 0) {
+            out = nfds++;
+            fds[out].fd     = g_state.run.out;
+            fds[out].events = POLLIN;
+        }
+        if (g_state.run_pending) {
+            in = nfds++;
+            fds[in].fd     = g_state.run.in;
+            fds[in].events = POLLOUT;
+        }
+
+        if (g_state.check.out >= 0) {
+            cout = nfds++;
+            fds[cout].fd     = g_state.check.out;
+            fds[cout].events = POLLIN;
+        }
+        if (g_state.check_buf) {
+            cin = nfds++;
+            fds[cin].fd     = g_state.check.in;
+            fds[cin].events = POLLOUT;
+        }
+
+        if (g_state.comp.wake[0] >= 0) {
+            comp = nfds++;
+            fds[comp].fd     = g_state.comp.wake[0];
+            fds[comp].events = POLLIN;
+        }
+
+        if (timeout && g_state.check_due) {
+            long long left = g_state.check_due - now_ms();
+
+            timeout = left > 0? left: 0;
+        }
+        if (kill_in >= 0 && (timeout < 0 || kill_in < timeout))
+            timeout = kill_in;
+        if (g_state.pasting) {
+            long long left = g_state.paste_at + PASTE_IDLE_MS - now_ms();
+
+            if (left < 0) left = 0;
+            if (timeout < 0 || left < timeout)
+                timeout = left;
+        }
+
+        for (i = 0; i < nfds; i++)
+            fds[i].revents = 0;
+
+        if (poll(fds, nfds, timeout) < 0 && errno != EINTR)
+            die("poll error\n");
+
+        if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL))
+            break;
+
+        if (more || fds[0].revents || fds[1].revents)
+            if ((quit = handle_events(&more))) break;
+        if (g_state.pasting
+                && now_ms() - g_state.paste_at >= PASTE_IDLE_MS)
+            paste_apply();
+
+        if (fds[2].revents) {
+            char buf[64];
+
+            while (read(g_state.child_wake[0], buf, sizeof(buf)) > 0);
+        }
+        if (g_state.run.pid >= 0 && g_state.run.out < 0)
+            run_reap();
+        if (g_state.check.pid >= 0 && g_state.check.out < 0)
+            check_reap();
+
+        if (in >= 0 && fds[in].revents && g_state.run_pending)
+            run_feed();
+        if (out >= 0 && fds[out].revents && g_state.run.out >= 0)
+            run_read();
+
+        if (cin >= 0 && fds[cin].revents && g_state.check_buf)
+            check_feed();
+        if (cout >= 0 && fds[cout].revents && g_state.check.out >= 0)
+            check_read();
+        if (g_state.check_due && now_ms() >= g_state.check_due) {
+            g_state.check_due = 0;
+            check_start();
+        }
+
+        if (comp >= 0 && fds[comp].revents)
+            complete_listing();
+
+        /* a big search goes on over several frames */
+        if (g_state.searching && g_state.search.running) {
+            search_step(&g_state.search, &g_state.history,
+                    now_us() + SEARCH_STEP_MS * 1000);
+            g_state.redraw |= REDRAW_ALL;
+        }
+
         draw_screen();
     }
 
     /* cleanup */
+    run_stop();
+    check_stop();
+    reap_flush();
+    signal(SIGCHLD, SIG_DFL);
+    close(g_state.child_wake[0]);
+    close(g_state.child_wake[1]);
+    g_state.child_wake[0] = g_state.child_wake[1] = -1;
+    complete_stop(&g_state.comp);
+    tb_send(PASTE_DISABLE, sizeof(PASTE_DISABLE)-1);
     tb_shutdown();
+
+    return quit;
 }
 
 static int
-execute_commands()
+execute_commands(size_t *nbytes, long long *elapsed)
 {
-    FILE *sh;
+    Shell     sh;
+    long long start;
 
-    if (!(sh = popen(SHELL_COMMAND, "w")))
+    if (shell_spawn(&sh, SHELL_COMMAND, NULL, SHELL_STDIN) < 0)
         die("open shell error\n");
 
-    linelist_print(g_state.lines, sh);
-    return pclose(sh);
+    start = now_us();
+    linelist_write(g_state.lines->head, NULL, sh.in, nbytes);
+    *elapsed = now_us() - start;
+
+    return shell_wait(&sh, NULL);
+}
+
+/* every line (or block) in its own shell, max at a time */
+static int
+execute_jobs(size_t max, int report, size_t *nbytes, long long *elapsed,
+        size_t *njobs, size_t *nfailed)
+{
+    Job       *jobs;
+    long long start;
+    size_t    i;
+    int       status;
+
+    *njobs = jobs_split(g_state.lines, JOB_SPLIT_BLOCKS, &jobs);
+
+    start    = now_us();
+    status   = jobs_run(jobs, *njobs, max, SHELL_COMMAND, nbytes);
+    *elapsed = now_us() - start;
+
+    for (i = 0, *nfailed = 0; i < *njobs; i++)
+        if (jobs[i].status) (*nfailed)++;
+
+    if (report) {
+        fflush(stdout);
+        jobs_report(jobs, *njobs, *elapsed, stdout);
+    }
+
+    free(jobs);
+    return status;
 }
 
 int
 main(int argc, char *argv[])
 {
-    int exitcode = 0;
-    
-    int flag_show_exitcode  = 0;
-    int flag_print_commands = 0;
+    int       exitcode = 0;
+    size_t    nbytes   = 0;
+    long long elapsed  = 0;
+    size_t    njobs    = 0;
+    int       quit;
+    size_t    nfailed  = 0;
+
+    int  flag_show_exitcode  = 0;
+    int  flag_print_commands = 0;
+    char *flag_file          = NULL;
+    int  flag_coproc         = 0;
+    int  flag_jobs           = 0;
+    int  flag_timing         = 0;
+    int  flag_recover        = 0;
+    char *home;
+    char journal[4096], recover[4096], history[4096], cache[4096];
 
     ARGBEGIN {
         case 'h':
@@ -354,25 +1877,85 @@ main(int argc, char *argv[])
         case 'c':
             flag_print_commands = 1;
             break;
+        case 'f':
+            flag_file = EARGF(die(g_usage));
+            break;
+        case 'p':
+            flag_coproc = 1;
+            break;
+        case 'j':
+            if ((flag_jobs = atoi(EARGF(die(g_usage)))) < 1)
+                die("-j needs a positive number\n");
+            break;
+        case 't':
+            flag_timing = 1;
+            break;
+        case 'r':
+            flag_recover = 1;
+            break;
         default:
             printf(g_usage);
             die("\nunknown flag '%c'\n", ARGC());
     } ARGEND;
 
-    state_init();
+    /* a shell that exits early must not take us down */
+    signal(SIGPIPE, SIG_IGN);
+
+    home = getenv("HOME")? getenv("HOME"): ".";
+    /* every session has its own journal */
+    snprintf(journal, sizeof(journal), "%s/%s.%ld",
+            home, JOURNAL_FILE, (long)getpid());
+    snprintf(history, sizeof(history), "%s/%s", home, HISTORY_FILE);
+    snprintf(cache, sizeof(cache), "%s/%s", home, COMPLETE_CACHE_FILE);
+
+    if (flag_recover && (!*JOURNAL_FILE
+                || journal_find(home, JOURNAL_FILE, recover,
+                    sizeof(recover)) < 0))
+        die("no journal to recover\n");
+
+    /* a recovered session starts from the journal, not the file */
+    state_init(flag_recover? NULL: flag_file);
+    if (flag_recover)
+        journal_replay(recover, g_state.lines);
+    if (*JOURNAL_FILE && journal_open(&g_state.journal, journal,
+                g_state.lines, JOURNAL_SYNC_MS) < 0 && errno == EEXIST)
+        die("%s is left from a session that died, "
+                "recover it with -r or remove it\n", journal);
+    /* the recovered text is in our journal now */
+    if (flag_recover && g_state.journal.fd >= 0)
+        unlink(recover);
+    if (*HISTORY_FILE)
+        history_init(&g_state.history, history);
+    complete_start(&g_state.comp, cache);
+    g_state.coproc = flag_coproc;
+
+    quit = tui_loop();
+    journal_close(&g_state.journal, quit);
 
-    tui_loop();
+    if (g_state.execute_on_exit)
+        history_add(&g_state.history, g_state.lines->head, NULL);
 
     if (flag_print_commands) {
         printf("commands:\n");
-        linelist_print(g_state.lines, stdout);
+        fflush(stdout);
+        linelist_write(g_state.lines->head, NULL, STDOUT_FILENO, &nbytes);
     }
 
-    if (g_state.execute_on_exit)
-        exitcode = execute_commands();
+    if (g_state.execute_on_exit && (flag_jobs || flag_timing))
+        exitcode = execute_jobs(flag_jobs? flag_jobs: 1, flag_timing,
+                &nbytes, &elapsed, &njobs, &nfailed);
+    else if (g_state.execute_on_exit)
+        exitcode = execute_commands(&nbytes, &elapsed);
 
-    if (flag_show_exitcode)
+    if (flag_show_exitcode) {
         printf("exitcode %d\n", exitcode);
+        if (g_state.execute_on_exit && (flag_jobs || flag_timing))
+            printf("%zu of %zu jobs failed\n", nfailed, njobs);
+        if (g_state.execute_on_exit && flag_timing)
+            printf("sent %zu bytes in %.3f ms (%.1f MB/s)\n", nbytes,
+                    elapsed / 1000.0,
+                    elapsed? nbytes / (double)elapsed: 0.0);
+    }
 
     state_cleanup();
     return 0;
@@ -0,0 +1,322 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "linelist.h"
+#include "shell.h"
+#include "jobs.h"
+
+/* longest output line kept together, longer ones are cut */
+#define JOB_LINE_MAX 4096
+
+/* a job that closed its output but hasn't exited is looked at
+ * again this often */
+#define JOB_REAP_MS  10
+
+typedef struct {
+    Job    *job;     /* NULL if the slot is free */
+    Shell  sh;       /* sh.out is -1 once the output ended */
+    char   *pending; /* script part not sent yet */
+    size_t pending_len;
+    size_t pending_off;
+    char   out[JOB_LINE_MAX]; /* partial output line */
+    size_t out_len;
+} Slot;
+
+static int
+line_blank(Line *line)
+{
+    size_t i;
+
+    for (i = 0; i < line->len; i++)
+        if (line_at(line, i) != ' ')
+            return 0;
+
+    return 1;
+}
+
+/* every non blank line becomes a job, or with blocks every run of
+ * non blank lines. returns the number of jobs */
+size_t
+jobs_split(LineList *list, int blocks, Job **jobs)
+{
+    size_t n = 0, cap = 16, lineno = 1;
+    Line   *line;
+
+    if (!(*jobs = malloc(cap * sizeof(Job))))
+        die("jobs alloc err\n");
+
+    for (line = list->head; line; line = line->next, lineno++) {
+        if (line_blank(line))
+            continue;
+
+        if (blocks && n && (*jobs)[n-1].last == line->prev) {
+            (*jobs)[n-1].last = line;
+            continue;
+        }
+
+        if (n == cap) {
+            cap *= 2;
+            if (!(*jobs = realloc(*jobs, cap * sizeof(Job))))
+                die("jobs alloc err\n");
+        }
+
+        (*jobs)[n].first  = line;
+        (*jobs)[n].last   = line;
+        (*jobs)[n].lineno = lineno;
+        (*jobs)[n].status = 0;
+        n++;
+    }
+
+    return n;
+}
+
+/* print complete lines of a slot's output with the job prefix,
+ * everything buffered if flush is set */
+static void
+slot_print(Slot *slot, int flush)
+{
+    char   line[JOB_LINE_MAX + 32];
+    size_t start = 0, i;
+
+    for (i = 0; i < slot->out_len; i++) {
+        int n;
+
+        if (slot->out[i] != '\n' && !(flush && i == slot->out_len - 1))
+            continue;
+
+        n = snprintf(line, 32, "[%zu] ", slot->job->lineno);
+        memcpy(&line[n], &slot->out[start], i - start + 1);
+        n += i - start + 1;
+        if (line[n-1] != '\n')
+            line[n++] = '\n';
+
+        write(STDOUT_FILENO, line, n);
+        start = i + 1;
+    }
+
+    memmove(slot->out, &slot->out[start], slot->out_len - start);
+    slot->out_len -= start;
+}
+
+static void
+slot_start(Slot *slot, Job *job, const char *cmd, size_t *nbytes)
+{
+    size_t sent = 0;
+
+    slot->job     = job;
+    slot->out_len = 0;
+    slot->pending = NULL;
+
+    memset(&job->usage, 0, sizeof(job->usage));
+    job->start = now_us();
+    job->wall  = 0;
+
+    if (shell_spawn(&slot->sh, cmd, NULL, SHELL_STDIN | SHELL_CAPTURE) < 0) {
+        fprintf(stderr, "[%zu] can't start %s\n", job->lineno, cmd);
+        job->status = 127 << 8;
+        slot->job   = NULL;
+        return;
+    }
+
+    fcntl(slot->sh.in, F_SETFL, O_NONBLOCK);
+
+    if (linelist_write(job->first, job->last, slot->sh.in, &sent) < 0
+            && errno == EAGAIN) {
+        slot->pending = linelist_dump(job->first, job->last, sent,
+                &slot->pending_len);
+        slot->pending_off = 0;
+    } else {
+        close(slot->sh.in);
+        slot->sh.in = -1;
+    }
+
+    *nbytes += sent;
+}
+
+static void
+slot_feed(Slot *slot, size_t *nbytes)
+{
+    ssize_t n = write(slot->sh.in, &slot->pending[slot->pending_off],
+            slot->pending_len - slot->pending_off);
+
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    if (n > 0) {
+        *nbytes           += n;
+        slot->pending_off += n;
+        if (slot->pending_off < slot->pending_len)
+            return;
+    }
+
+    close(slot->sh.in);
+    slot->sh.in = -1;
+    free(slot->pending);
+    slot->pending = NULL;
+}
+
+/* a job is done once its shell exited, which can be a while after
+ * it closed its output. returns 1 then */
+static int
+slot_reap(Slot *slot)
+{
+    if (!shell_reap(&slot->sh, &slot->job->status, &slot->job->usage))
+        return 0;
+
+    slot->job->wall = now_us() - slot->job->start;
+    slot->job       = NULL;
+
+    return 1;
+}
+
+/* returns 1 once the job is done */
+static int
+slot_read(Slot *slot)
+{
+    ssize_t n = read(slot->sh.out, &slot->out[slot->out_len],
+            JOB_LINE_MAX - slot->out_len);
+
+    if (n < 0 && errno == EINTR)
+        return 0;
+
+    if (n > 0) {
+        slot->out_len += n;
+        slot_print(slot, slot->out_len == JOB_LINE_MAX);
+        return 0;
+    }
+
+    slot_print(slot, 1);
+    free(slot->pending);
+    slot->pending = NULL;
+    shell_close(&slot->sh);
+
+    return slot_reap(slot);
+}
+
+/* run jobs with at most max of them at once, output lines are
+ * prefixed with the job's line number. returns the status of the
+ * first failed job in list order, 0 if all succeeded */
+int
+jobs_run(Job *jobs, size_t njobs, size_t max, const char *cmd,
+        size_t *nbytes)
+{
+    Slot          *slots;
+    struct pollfd *fds;
+    size_t        next = 0, running = 0, i;
+
+    *nbytes = 0;
+
+    if (!(slots = calloc(max, sizeof(Slot))) ||
+            !(fds = calloc(max * 2, sizeof(struct pollfd))))
+        die("jobs alloc err\n");
+
+    while (next < njobs || running) {
+        size_t nfds = 0;
+        int    timeout = -1;
+
+        for (i = 0; i < max && next < njobs; i++)
+            if (!slots[i].job) {
+                slot_start(&slots[i], &jobs[next++], cmd, nbytes);
+                if (slots[i].job) running++;
+            }
+
+        if (!running) continue;
+
+        for (i = 0; i < max; i++) {
+            if (!slots[i].job) continue;
+            if (slots[i].sh.out < 0)
+                timeout = JOB_REAP_MS;
+
+            fds[nfds].fd     = slots[i].sh.out;
+            fds[nfds].events = POLLIN;
+            nfds++;
+
+            fds[nfds].fd     = slots[i].pending? slots[i].sh.in: -1;
+            fds[nfds].events = POLLOUT;
+            nfds++;
+        }
+
+        if (poll(fds, nfds, timeout) < 0) {
+            if (errno == EINTR) continue;
+            die("poll error\n");
+        }
+
+        for (i = 0, nfds = 0; i < max; i++) {
+            if (!slots[i].job) continue;
+
+            if (fds[nfds+1].revents && slots[i].pending)
+                slot_feed(&slots[i], nbytes);
+            if (slots[i].sh.out < 0) {
+                if (slot_reap(&slots[i]))
+                    running--;
+            } else if (fds[nfds].revents && slot_read(&slots[i]))
+                running--;
+
+            nfds += 2;
+        }
+    }
+
+    free(slots);
+    free(fds);
+
+    for (i = 0; i < njobs; i++)
+        if (jobs[i].status)
+            return jobs[i].status;
+
+    return 0;
+}
+
+static double
+tv_ms(struct timeval tv)
+{
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* table of per job wall time, cpu time and peak memory,
+ * elapsed is the wall time of the whole run */
+void
+jobs_report(Job *jobs, size_t njobs, long long elapsed, FILE *fp)
+{
+    double user = 0, sys = 0;
+    long   rss  = 0;
+    size_t slow = 0, i, j;
+
+    fprintf(fp, "%6s %10s %10s %10s %10s %6s  %s\n",
+            "line", "wall ms", "user ms", "sys ms", "rss KiB",
+            "status", "command");
+
+    for (i = 0; i < njobs; i++) {
+        Job  *job = &jobs[i];
+        char cmd[41];
+
+        for (j = 0; j < job->first->len && j < sizeof(cmd)-1; j++)
+            cmd[j] = line_at(job->first, j);
+        cmd[j] = 0;
+
+        fprintf(fp, "%6zu %10.3f %10.3f %10.3f %10ld %6d  %s%s\n",
+                job->lineno, job->wall / 1000.0,
+                tv_ms(job->usage.ru_utime), tv_ms(job->usage.ru_stime),
+                job->usage.ru_maxrss, job->status, cmd,
+                job->first != job->last ||
+                j < job->first->len? "...": "");
+
+        user += tv_ms(job->usage.ru_utime);
+        sys  += tv_ms(job->usage.ru_stime);
+        if (job->usage.ru_maxrss > rss) rss = job->usage.ru_maxrss;
+        if (job->wall > jobs[slow].wall) slow = i;
+    }
+
+    fprintf(fp, "%6s %10.3f %10.3f %10.3f %10ld\n",
+            "total", elapsed / 1000.0, user, sys, rss);
+    if (njobs)
+        fprintf(fp, "slowest: line %zu, %.3f ms\n",
+                jobs[slow].lineno, jobs[slow].wall / 1000.0);
+}
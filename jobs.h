@@ -0,0 +1,23 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdio.h>
+#include <sys/resource.h>
+
+/* lines first..last run by one shell */
+typedef struct {
+    Line          *first;
+    Line          *last;
+    size_t        lineno;  /* number of first, from 1 */
+    int           status;  /* wait status            */
+    long long     start;   /* now_us at spawn        */
+    long long     wall;    /* us until reaped        */
+    struct rusage usage;   /* from wait4             */
+} Job;
+
+size_t jobs_split(LineList *list, int blocks, Job **jobs);
+int    jobs_run(Job *jobs, size_t njobs, size_t max, const char *cmd,
+                size_t *nbytes);
+void   jobs_report(Job *jobs, size_t njobs, long long elapsed, FILE *fp);
+
+#endif
@@ -0,0 +1,285 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "linelist.h"
+#include "load.h"
+#include "undo.h"
+#include "journal.h"
+
+/*
+ * a record is a header line "i|d <line> <col> <len>\n", inserts follow
+ * it with the text and a '\n'. deletes carry no text, replay only
+ * needs the length
+ */
+#define JOURNAL_HEADER_MAX 80
+
+static void
+jbuf_add(JournalBuf *b, const char *data, size_t n)
+{
+    if (b->len + n > b->cap) {
+        b->cap = (b->len + n) * 2;
+        if (!(b->buf = realloc(b->buf, b->cap)))
+            die("journal alloc err\n");
+    }
+
+    memcpy(&b->buf[b->len], data, n);
+    b->len += n;
+}
+
+static void
+write_all(int fd, const char *data, size_t n)
+{
+    while (n) {
+        ssize_t w = write(fd, data, n);
+
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return; /* disk full, nothing better to do */
+
+        data += w;
+        n    -= w;
+    }
+}
+
+/* writes whatever piled up since the last round in one go, syncing
+ * at most every sync_ms. unsynced data is synced once the
+ * input goes quiet for that long */
+static void *
+journal_writer(void *arg)
+{
+    Journal         *j     = arg;
+    long long       synced = now_ms();
+    int             dirty  = 0, stop;
+    struct timespec ts;
+
+    pthread_mutex_lock(&j->lock);
+    for (;;) {
+        while (!j->pending.len && !j->stop) {
+            if (!dirty) {
+                pthread_cond_wait(&j->wake, &j->lock);
+                continue;
+            }
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec  += j->sync_ms / 1000;
+            ts.tv_nsec += j->sync_ms % 1000 * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+
+            if (pthread_cond_timedwait(&j->wake, &j->lock, &ts)
+                    == ETIMEDOUT) {
+                pthread_mutex_unlock(&j->lock);
+                fdatasync(j->fd);
+                pthread_mutex_lock(&j->lock);
+                synced = now_ms();
+                dirty  = 0;
+            }
+        }
+
+        /* swap, the input side keeps appending meanwhile */
+        {
+            JournalBuf tmp = j->writing;
+
+            j->writing = j->pending;
+            j->pending = tmp;
+        }
+        stop = j->stop;
+        pthread_mutex_unlock(&j->lock);
+
+        write_all(j->fd, j->writing.buf, j->writing.len);
+        j->writing.len = 0;
+        dirty = 1;
+
+        if (stop || now_ms() - synced >= j->sync_ms) {
+            fdatasync(j->fd);
+            synced = now_ms();
+            dirty  = 0;
+        }
+
+        pthread_mutex_lock(&j->lock);
+        if (stop && !j->pending.len) break;
+    }
+    pthread_mutex_unlock(&j->lock);
+
+    return NULL;
+}
+
+/* start a fresh journal holding the current contents of list as its
+ * first insert. an existing file is left alone, it may hold a session
+ * to recover. -1 if the file can't be made, journaling is off then */
+int
+journal_open(Journal *j, const char *path, LineList *list, long sync_ms)
+{
+    char   head[JOURNAL_HEADER_MAX];
+    size_t len = 0, nbytes;
+    Line   *line;
+    int    n;
+
+    memset(j, 0, sizeof(*j));
+    j->sync_ms = sync_ms;
+    j->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (j->fd < 0)
+        return -1;
+
+    if (!(j->path = strdup(path)))
+        die("journal alloc err\n");
+
+    /* the loaded text goes straight from the lines to the file, its
+     * trailing newline ends the record */
+    for (line = list->head; line; line = line->next)
+        len += line->len + 1;
+    n = snprintf(head, sizeof(head), "i 0 0 %zu\n", len - 1);
+    write_all(j->fd, head, n);
+    linelist_write(list->head, NULL, j->fd, &nbytes);
+
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->wake, NULL);
+    if (pthread_create(&j->thread, NULL, journal_writer, j)) {
+        close(j->fd);
+        free(j->path);
+        j->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+journal_record(Journal *j, int type, size_t line, size_t col,
+        const char *text, size_t n)
+{
+    char head[JOURNAL_HEADER_MAX];
+    int  len;
+
+    if (j->fd < 0) return;
+
+    len = snprintf(head, sizeof(head), "%c %zu %zu %zu\n",
+            type == UNDO_INSERT? 'i': 'd', line, col, n);
+
+    pthread_mutex_lock(&j->lock);
+    jbuf_add(&j->pending, head, len);
+    if (type == UNDO_INSERT) {
+        jbuf_add(&j->pending, text, n);
+        jbuf_add(&j->pending, "\n", 1);
+    }
+    pthread_cond_signal(&j->wake);
+    pthread_mutex_unlock(&j->lock);
+}
+
+/* flush and stop the writer. a session that was quit on purpose
+ * has nothing to recover, remove drops the file then */
+void
+journal_close(Journal *j, int remove)
+{
+    if (j->fd < 0) return;
+
+    pthread_mutex_lock(&j->lock);
+    j->stop = 1;
+    pthread_cond_signal(&j->wake);
+    pthread_mutex_unlock(&j->lock);
+    pthread_join(j->thread, NULL);
+
+    close(j->fd);
+    if (remove)
+        unlink(j->path);
+    j->fd = -1;
+
+    pthread_mutex_destroy(&j->lock);
+    pthread_cond_destroy(&j->wake);
+    free(j->pending.buf);
+    free(j->writing.buf);
+    free(j->path);
+}
+
+/* the newest journal in dir named prefix.<pid> whose session is gone,
+ * its path goes to path. -1 if there is none */
+int
+journal_find(const char *dir, const char *prefix, char *path, size_t size)
+{
+    DIR           *d;
+    struct dirent *e;
+    struct stat   st;
+    time_t        newest = 0;
+    size_t        plen   = strlen(prefix);
+    char          buf[4096];
+    int           found  = -1;
+
+    if (!(d = opendir(dir)))
+        return -1;
+
+    while ((e = readdir(d))) {
+        char *num = &e->d_name[plen + 1], *end;
+        long pid;
+
+        if (strncmp(e->d_name, prefix, plen) || e->d_name[plen] != '.')
+            continue;
+        pid = strtol(num, &end, 10);
+        if (end == num || *end || pid <= 0)
+            continue;
+
+        /* a live session still owns it */
+        if (!kill(pid, 0) || errno == EPERM)
+            continue;
+
+        snprintf(buf, sizeof(buf), "%s/%s", dir, e->d_name);
+        if (stat(buf, &st) < 0 || (!found && st.st_mtime < newest))
+            continue;
+
+        snprintf(path, size, "%s", buf);
+        newest = st.st_mtime;
+        found  = 0;
+    }
+    closedir(d);
+
+    return found;
+}
+
+/* apply the journal at path to list. a record cut short by the crash
+ * ends the replay */
+void
+journal_replay(const char *path, LineList *list)
+{
+    LoadBuf lb = {0};
+    char    *p, *end, *nl;
+
+    load_file(&lb, path);
+    p   = lb.data;
+    end = lb.data + lb.len;
+
+    while (p < end && (nl = memchr(p, '\n', end - p))) {
+        char   type, head[JOURNAL_HEADER_MAX];
+        size_t line, col, n, endpos;
+        Line   *l;
+
+        if (nl - p >= JOURNAL_HEADER_MAX) break;
+        memcpy(head, p, nl - p);
+        head[nl - p] = 0;
+        p = nl + 1;
+
+        if (sscanf(head, "%c %zu %zu %zu", &type, &line, &col, &n) != 4
+                || !(l = linelist_at(list, line)) || col > l->len)
+            break;
+
+        if (type == 'i') {
+            if ((size_t)(end - p) < n + 1 || p[n] != '\n') break;
+            linelist_splice(list, l, col, p, n, &endpos);
+            p += n + 1;
+        } else {
+            linelist_erase(list, l, col, n, NULL);
+        }
+    }
+
+    load_free(&lb);
+}
@@ -0,0 +1,35 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+
+typedef struct {
+    char   *buf;
+    size_t len;
+    size_t cap;
+} JournalBuf;
+
+/* edits appended to a file by a writer thread, so a session that
+ * dies can be replayed. the input path only copies into pending */
+typedef struct {
+    int             fd;       /* -1 if journaling is off   */
+    char            *path;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    JournalBuf      pending;  /* filled by journal_record  */
+    JournalBuf      writing;  /* owned by the writer       */
+    long            sync_ms;  /* fdatasync at most this often */
+    int             stop;
+} Journal;
+
+int  journal_open(Journal *j, const char *path, LineList *list,
+                  long sync_ms);
+void journal_record(Journal *j, int type, size_t line, size_t col,
+                    const char *text, size_t n);
+void journal_close(Journal *j, int remove);
+int  journal_find(const char *dir, const char *prefix, char *path,
+                  size_t size);
+void journal_replay(const char *path, LineList *list);
+
+#endif
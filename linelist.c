@@ -1,27 +1,80 @@
+#define _XOPEN_SOURCE 700
+
 #include "stdio.h"
 #include "stdlib.h"
 #include "string.h"
+#include "errno.h"
+#include "limits.h"
+#include "sys/uio.h"
 
 #include "common.h"
 #include "linelist.h"
 
-static Line *
-line_create(const char *text)
+static int
+buf_class(size_t cap)
 {
-    Line *node;
+    int    class = 0;
+    size_t size  = LINE_BUF_MIN;
 
-    if (!(node = malloc(sizeof(Line))))
-        die("line alloc err\n");
+    while (size < cap) {
+        size <<= 1;
+        class++;
+    }
 
-    node->len = text? strlen(text): 0;
-    node->cap = node->len + 16;
-    if (!(node->buf = malloc(node->cap)))
-        die("line buf alloc err\n");
+    return class;
+}
+
+static char *
+buf_alloc(LineList *list, size_t *cap)
+{
+    char *buf;
+    int  class;
+
+    if (*cap > LINE_BUF_MAX) {
+        if (!(buf = malloc(*cap)))
+            die("line buf alloc err\n");
+        list->nheap++;
+        return buf;
+    }
+
+    class = buf_class(*cap);
+    *cap  = (size_t)LINE_BUF_MIN << class;
+
+    if ((buf = list->free_bufs[class])) {
+        list->free_bufs[class] = *(char **)buf;
+        return buf;
+    }
+
+    return arena_alloc(&list->arena, *cap);
+}
+
+static void
+buf_free(LineList *list, char *buf, size_t cap)
+{
+    int class;
 
-    if (text)
-        strcpy(node->buf, text);
+    if (!cap) return; /* borrowed */
+
+    if (cap > LINE_BUF_MAX) {
+        free(buf);
+        list->nheap--;
+        return;
+    }
+
+    class = buf_class(cap);
+    *(char **)buf          = list->free_bufs[class];
+    list->free_bufs[class] = buf;
+}
+
+static Line *
+line_alloc(LineList *list)
+{
+    Line *node;
+
+    if ((node = list->free_lines))
+        list->free_lines = node->next;
     else
-        node->buf[0] = 0;
+        node = arena_alloc(&list->arena, sizeof(Line));
 
     node->prev = NULL;
     node->next = NULL;
@@ -29,12 +82,429 @@ line_create(const char *text)
     return node;
 }
 
+static Line *
+line_create(LineList *list, const char *text, size_t len)
+{
+    Line *node = line_alloc(list);
+
+    node->len = len;
+    node->gap = len;
+    node->cap = len + 1;
+    node->buf = buf_alloc(list, &node->cap);
+
+    if (len)
+        memcpy(node->buf, text, len);
+    node->buf[len] = 0;
+
+    return node;
+}
+
+static Line *
+line_create_ref(LineList *list, const char *text, size_t len)
+{
+    Line *node = line_alloc(list);
+
+    node->len = len;
+    node->gap = len;
+    node->cap = 0;
+    node->buf = (char *)text;
+
+    return node;
+}
+
 static void
-line_free(Line *node)
+line_free(LineList *list, Line *node)
 {
     if (!node) return;
-    free(node->buf);
-    free(node);
+    buf_free(list, node->buf, node->cap);
+    node->next       = list->free_lines;
+    list->free_lines = node;
+}
+
+// start: index funcs
+
+#ifdef LINELIST_TREE
+
+#define TREE_SIZE(n) ((n)? (n)->size: 0)
+
+static void
+tree_update(Line *n)
+{
+    n->size = 1 + TREE_SIZE(n->left) + TREE_SIZE(n->right);
+}
+
+static void
+tree_rotate_up(LineList *list, Line *n)
+{
+    Line *p = n->parent, *g = p->parent;
+
+    if (p->left == n) {
+        p->left = n->right;
+        if (n->right) n->right->parent = p;
+        n->right = p;
+    } else {
+        p->right = n->left;
+        if (n->left) n->left->parent = p;
+        n->left = p;
+    }
+
+    p->parent = n;
+    n->parent = g;
+
+    if (!g)
+        list->root = n;
+    else if (g->left == p)
+        g->left = n;
+    else
+        g->right = n;
+
+    tree_update(p);
+    tree_update(n);
+}
+
+static void
+tree_insert_after(LineList *list, Line *after, Line *n)
+{
+    Line *p;
+
+    /* xorshift32 */
+    list->seed ^= list->seed << 13;
+    list->seed ^= list->seed >> 17;
+    list->seed ^= list->seed << 5;
+
+    n->left = n->right = n->parent = NULL;
+    n->size = 1;
+    n->prio = list->seed;
+
+    if (!list->root) {
+        list->root = n;
+        return;
+    }
+
+    /* successor slot: right child of after or leftmost of its right
+     * subtree, leftmost of the whole tree when inserting at the front */
+    if (after && !after->right) {
+        after->right = n;
+        n->parent    = after;
+    } else {
+        p = after? after->right: list->root;
+        while (p->left) p = p->left;
+        p->left   = n;
+        n->parent = p;
+    }
+
+    for (p = n->parent; p; p = p->parent)
+        p->size++;
+
+    while (n->parent && n->parent->prio < n->prio)
+        tree_rotate_up(list, n);
+}
+
+static void
+tree_remove(LineList *list, Line *n)
+{
+    Line *child, *p;
+
+    while (n->left && n->right)
+        tree_rotate_up(list, n->left->prio > n->right->prio?
+                n->left: n->right);
+
+    child = n->left? n->left: n->right;
+    if (child)
+        child->parent = n->parent;
+
+    if (!n->parent)
+        list->root = child;
+    else if (n->parent->left == n)
+        n->parent->left = child;
+    else
+        n->parent->right = child;
+
+    for (p = n->parent; p; p = p->parent)
+        p->size--;
+}
+
+size_t
+linelist_index(LineList *list, Line *line)
+{
+    size_t index = TREE_SIZE(line->left);
+
+    UNUSED(list);
+
+    for (; line->parent; line = line->parent)
+        if (line->parent->right == line)
+            index += TREE_SIZE(line->parent->left) + 1;
+
+    return index;
+}
+
+Line *
+linelist_at(LineList *list, size_t index)
+{
+    Line *n = list->root;
+
+    while (n) {
+        size_t left = TREE_SIZE(n->left);
+
+        if (index < left) {
+            n = n->left;
+        } else if (index == left) {
+            break;
+        } else {
+            index -= left + 1;
+            n = n->right;
+        }
+    }
+
+    return n;
+}
+
+#else
+
+size_t
+linelist_index(LineList *list, Line *line)
+{
+    size_t index = 0;
+
+    UNUSED(list);
+
+    for (; line->prev; line = line->prev)
+        index++;
+
+    return index;
+}
+
+Line *
+linelist_at(LineList *list, size_t index)
+{
+    Line *n = list->head;
+
+    for (; n && index; index--)
+        n = n->next;
+
+    return n;
+}
+
+#endif
+
+// end: index funcs
+
+static void
+line_link(LineList *list, Line *after, Line *node)
+{
+    node->prev = after;
+    node->next = after? after->next: list->head;
+
+    if (node->next)
+        node->next->prev = node;
+    else
+        list->tail = node;
+
+    if (after)
+        after->next = node;
+    else
+        list->head = node;
+
+#ifdef LINELIST_TREE
+    tree_insert_after(list, after, node);
+#endif
+    list->count++;
+}
+
+static void
+line_unlink(LineList *list, Line *node)
+{
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        list->head = node->next;
+
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        list->tail = node->prev;
+
+#ifdef LINELIST_TREE
+    tree_remove(list, node);
+#endif
+    list->count--;
+}
+
+static void
+line_move_gap(Line *line, size_t pos)
+{
+    size_t gaplen = line->cap - line->len;
+
+    if (pos < line->gap)
+        memmove(&line->buf[pos+gaplen], &line->buf[pos], line->gap-pos);
+    else if (pos > line->gap)
+        memmove(&line->buf[line->gap], &line->buf[line->gap+gaplen],
+                pos-line->gap);
+
+    line->gap = pos;
+}
+
+void
+line_reserve(LineList *list, Line *line, size_t cap)
+{
+    char   *buf;
+    size_t newcap, taillen = line->len - line->gap;
+
+    if (cap <= line->len)
+        cap = line->len + 1;
+    if (cap <= line->cap) return;
+
+    newcap = cap > LINE_BUF_MAX? cap * 2: cap;
+
+    if (line->cap > LINE_BUF_MAX) {
+        if (!(buf = realloc(line->buf, newcap)))
+            die("realloc line buf err\n");
+        memmove(&buf[newcap-taillen], &buf[line->cap-taillen], taillen);
+    } else {
+        /* also takes borrowed lines over, taillen is 0 for them */
+        buf = buf_alloc(list, &newcap);
+        memcpy(buf, line->buf, line->gap);
+        memcpy(&buf[newcap-taillen], &line->buf[line->cap-taillen],
+                taillen);
+        buf_free(list, line->buf, line->cap);
+    }
+
+    line->buf = buf;
+    line->cap = newcap;
+}
+
+void
+line_insert(LineList *list, Line *line, size_t pos,
+        const char *text, size_t n)
+{
+    line_reserve(list, line, line->len + n + 1);
+    line_move_gap(line, pos);
+
+    memcpy(&line->buf[line->gap], text, n);
+    line->gap += n;
+    line->len += n;
+}
+
+void
+line_delete(LineList *list, Line *line, size_t pos, size_t n)
+{
+    line_reserve(list, line, 0);
+    line_move_gap(line, pos + n);
+
+    line->gap -= n;
+    line->len -= n;
+}
+
+Line *
+line_split(LineList *list, Line *line, size_t pos)
+{
+    Line *newline;
+
+    if (!line->cap) {
+        /* borrowed text splits without copying */
+        newline   = line_create_ref(list, &line->buf[pos], line->len - pos);
+        line->gap = pos;
+    } else {
+        line_move_gap(line, pos);
+        newline = line_create(list, &line->buf[line->cap-line->len+pos],
+                line->len - pos);
+    }
+
+    line->len = pos;
+    line_link(list, line, newline);
+
+    return newline;
+}
+
+void
+line_join(LineList *list, Line *line)
+{
+    Line   *next = line->next;
+    size_t front, taillen;
+
+    if (!next) return;
+
+    front   = next->gap;
+    taillen = next->len - front;
+
+    line_reserve(list, line, line->len + next->len + 1);
+    line_move_gap(line, line->len);
+
+    memcpy(&line->buf[line->gap], next->buf, front);
+    memcpy(&line->buf[line->gap+front],
+            &next->buf[next->cap-taillen], taillen);
+    line->gap += next->len;
+    line->len += next->len;
+
+    linelist_remove(list, next);
+}
+
+/* insert text that may hold newlines at pos, creating one line per
+ * newline. returns the line the text ends on, endpos is set to the
+ * position right after it */
+Line *
+linelist_splice(LineList *list, Line *line, size_t pos,
+        const char *text, size_t n, size_t *endpos)
+{
+    const char *nl = memchr(text, '\n', n);
+    Line       *tail;
+
+    if (!nl) {
+        line_insert(list, line, pos, text, n);
+        *endpos = pos + n;
+        return line;
+    }
+
+    tail = line_split(list, line, pos);
+    line_insert(list, line, pos, text, nl - text);
+    n   -= nl - text + 1;
+    text = nl + 1;
+
+    while ((nl = memchr(text, '\n', n))) {
+        Line *newline = line_create(list, text, nl - text);
+
+        line_link(list, line, newline);
+        line = newline;
+        n   -= nl - text + 1;
+        text = nl + 1;
+    }
+
+    line_insert(list, tail, 0, text, n);
+    *endpos = n;
+
+    return tail;
+}
+
+/* delete n bytes at pos, a newline counting as one byte that joins
+ * the next line in. the deleted text is copied to out if it's set */
+void
+linelist_erase(LineList *list, Line *line, size_t pos, size_t n, char *out)
+{
+    while (n) {
+        size_t k = line->len - pos < n? line->len - pos: n, i;
+
+        if (out)
+            for (i = 0; i < k; i++)
+                *out++ = line_at(line, pos + i);
+        if (k)
+            line_delete(list, line, pos, k);
+        n -= k;
+
+        if (!n || !line->next) break;
+
+        if (out) *out++ = '\n';
+        line_join(list, line);
+        n--;
+    }
+}
+
+const char *
+line_text(LineList *list, Line *line)
+{
+    line_reserve(list, line, 0);
+    line_move_gap(line, line->len);
+    line->buf[line->len] = 0;
+    return line->buf;
 }
 
 LineList *
@@ -45,6 +515,15 @@ linelist_create(void)
         die("linelist alloc err\n");
 
     list->head = list->tail = NULL;
+    list->count      = 0;
+#ifdef LINELIST_TREE
+    list->root       = NULL;
+    list->seed       = 2463534242u;
+#endif
+    list->free_lines = NULL;
+    list->nheap      = 0;
+    memset(list->free_bufs, 0, sizeof(list->free_bufs));
+    arena_init(&list->arena);
     return list;
 }
 
@@ -54,28 +533,30 @@ linelist_free(LineList *list)
     Line *node;
     if (!list) return;
 
-    node = list->head;
-    while (node) {
-        Line *next = node->next;
-        line_free(node);
-        node = next;
-    }
+    /* everything but grown buffers goes away with the arena */
+    for (node = list->head; node && list->nheap; node = node->next)
+        if (node->cap > LINE_BUF_MAX)
+            buf_free(list, node->buf, node->cap);
 
+    arena_release(&list->arena);
     free(list);
 }
 
 void
 linelist_append(LineList *list, const char *text)
 {
-    Line *node = line_create(text);
+    line_link(list, list->tail,
+            line_create(list, text, text? strlen(text): 0));
+}
 
-    if (!list->head) {
-        list->head = list->tail = node;
-    } else {
-        list->tail->next = node;
-        node->prev       = list->tail;
-        list->tail       = node;
-    }
+/* text is not copied and must outlive the list */
+Line *
+linelist_append_ref(LineList *list, const char *text, size_t len)
+{
+    Line *node = line_create_ref(list, text, len);
+
+    line_link(list, list->tail, node);
+    return node;
 }
 
 void
@@ -83,17 +564,8 @@ linelist_remove(LineList *list, Line *node)
 {
     if (!list || !node) return;
 
-    if (node->prev)
-        node->prev->next = node->next;
-    else
-        list->head = node->next;
-
-    if (node->next)
-        node->next->prev = node->prev;
-    else
-        list->tail = node->prev;
-
-    line_free(node);
+    line_unlink(list, node);
+    line_free(list, node);
 }
 
 Line *
@@ -105,16 +577,8 @@ linelist_insert_after(
     Line *newline;
     if (!list || !after) return NULL;
 
-    newline       = line_create(text);
-    newline->prev = after;
-    newline->next = after->next;
-
-    if (after->next)
-        after->next->prev = newline;
-    else
-        list->tail = newline;
-
-    after->next = newline;
+    newline = line_create(list, text, text? strlen(text): 0);
+    line_link(list, after, newline);
 
     return newline;
 }
@@ -141,8 +605,13 @@ linelist_traverse(
 static void
 linelist_cb_print(Line *line, void *ctx)
 {
-    FILE *output = (FILE *)ctx;
-    fprintf(output, "%s\n", line->buf);
+    FILE   *output = (FILE *)ctx;
+    size_t taillen = line->len - line->gap;
+
+    /* write both sides of the gap as is */
+    fwrite(line->buf, 1, line->gap, output);
+    fwrite(&line->buf[line->cap-taillen], 1, taillen, output);
+    fputc('\n', output);
 }
 
 // end: traverse funcs
@@ -152,3 +621,116 @@ linelist_print(LineList *list, FILE *output)
 {
     linelist_traverse(list, linelist_cb_print, output);
 }
+
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+/* write as much of iov as possible, dropping what was written */
+static int
+writev_all(int fd, struct iovec *iov, int cnt, size_t *nbytes)
+{
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        *nbytes += n;
+
+        /* partial write, skip what went out */
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+/* write lines from..to (to included, NULL for the end) to fd, one
+ * newline after each. line buffers are gathered straight into iovec
+ * batches, nothing is copied. the number of bytes written goes to
+ * nbytes, returns -1 on write errors */
+int
+linelist_write(Line *from, Line *to, int fd, size_t *nbytes)
+{
+    static char  nl = '\n';
+    struct iovec iov[IOV_MAX];
+    int          cnt = 0;
+    Line         *line;
+
+    *nbytes = 0;
+
+    for (line = from; line; line = line == to? NULL: line->next) {
+        size_t taillen = line->len - line->gap;
+
+        if (cnt + 3 > IOV_MAX) {
+            if (writev_all(fd, iov, cnt, nbytes) < 0) return -1;
+            cnt = 0;
+        }
+
+        if (line->gap) {
+            iov[cnt].iov_base = line->buf;
+            iov[cnt++].iov_len = line->gap;
+        }
+        if (taillen) {
+            iov[cnt].iov_base = &line->buf[line->cap-taillen];
+            iov[cnt++].iov_len = taillen;
+        }
+        iov[cnt].iov_base = &nl;
+        iov[cnt++].iov_len = 1;
+    }
+
+    return writev_all(fd, iov, cnt, nbytes);
+}
+
+static char *
+dump_part(char *dst, const char *src, size_t n, size_t *skip)
+{
+    if (*skip >= n) {
+        *skip -= n;
+        return dst;
+    }
+
+    memcpy(dst, src + *skip, n - *skip);
+    dst  += n - *skip;
+    *skip = 0;
+
+    return dst;
+}
+
+/* copy of what linelist_write would send for from..to, minus the
+ * first skip bytes. for writers that can't keep pointers into lines
+ * which may be edited before they are done */
+char *
+linelist_dump(Line *from, Line *to, size_t skip, size_t *len)
+{
+    char   *buf, *p;
+    size_t total = 0;
+    Line   *line;
+
+    for (line = from; line; line = line == to? NULL: line->next)
+        total += line->len + 1;
+
+    *len = total > skip? total - skip: 0;
+    if (!(p = buf = malloc(*len? *len: 1)))
+        die("dump alloc err\n");
+
+    for (line = from; line; line = line == to? NULL: line->next) {
+        size_t taillen = line->len - line->gap;
+
+        p = dump_part(p, line->buf, line->gap, &skip);
+        p = dump_part(p, &line->buf[line->cap-taillen], taillen, &skip);
+        p = dump_part(p, "\n", 1, &skip);
+    }
+
+    return buf;
+}
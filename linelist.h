@@ -1,26 +1,80 @@
 #ifndef LINELIST_H
 #define LINELIST_H
 
+#include "arena.h"
+
+/* line buffers up to LINE_BUF_MAX bytes are carved from the list arena
+ * in power of two size classes, bigger ones live on the heap */
+#define LINE_BUF_MIN     16
+#define LINE_BUF_MAX     256
+#define LINE_BUF_CLASSES 5
+
+/* text is kept as a gap buffer: buf[0..gap) holds the text before the
+ * gap and the last len-gap bytes of buf hold the rest, so edits at the
+ * cursor don't move the tail of the line. cap > len always holds,
+ * except for borrowed lines (cap == 0) which point into memory owned
+ * by the caller and get copied on their first edit */
 typedef struct Line {
     size_t      cap;
     size_t      len;
+    size_t      gap;
     char        *buf;
     struct Line *prev;
     struct Line *next;
+#ifdef LINELIST_TREE
+    /* order statistic treap over the lines, keyed by position */
+    struct Line *parent;
+    struct Line *left;
+    struct Line *right;
+    size_t      size;   /* lines in this subtree */
+    unsigned    prio;
+#endif
 } Line;
 
 typedef struct {
-    Line *head;
-    Line *tail;
+    Line     *head;
+    Line     *tail;
+    size_t   count;
+#ifdef LINELIST_TREE
+    Line     *root;
+    unsigned seed;
+#endif
+    Arena    arena;                        /* lines and small buffers */
+    Line     *free_lines;                  /* recycled line nodes     */
+    char     *free_bufs[LINE_BUF_CLASSES]; /* recycled small buffers  */
+    size_t   nheap;                        /* heap allocated buffers  */
 } LineList;
 
 LineList *linelist_create(void);
 void     linelist_free(LineList *list);
 void     linelist_append(LineList *list, const char *text);
+Line     *linelist_append_ref(LineList *list, const char *text, size_t len);
 void     linelist_remove(LineList *list, Line *node);
 Line     *linelist_insert_after(LineList *list,
                                 Line *after,
                                 const char *text);
 void     linelist_print(LineList *list, FILE *output);
+int      linelist_write(Line *from, Line *to, int fd, size_t *nbytes);
+char     *linelist_dump(Line *from, Line *to, size_t skip, size_t *len);
+Line     *linelist_splice(LineList *list, Line *line, size_t pos,
+                          const char *text, size_t n, size_t *endpos);
+void     linelist_erase(LineList *list, Line *line, size_t pos, size_t n,
+                        char *out);
+size_t   linelist_index(LineList *list, Line *line);
+Line     *linelist_at(LineList *list, size_t index);
+
+void     line_reserve(LineList *list, Line *line, size_t cap);
+void     line_insert(LineList *list, Line *line, size_t pos,
+                     const char *text, size_t n);
+void     line_delete(LineList *list, Line *line, size_t pos, size_t n);
+Line     *line_split(LineList *list, Line *line, size_t pos);
+void     line_join(LineList *list, Line *line);
+const char *line_text(LineList *list, Line *line);
+
+static inline char
+line_at(const Line *line, size_t i)
+{
+    return i < line->gap? line->buf[i]: line->buf[i+line->cap-line->len];
+}
 
 #endif
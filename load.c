@@ -0,0 +1,105 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "linelist.h"
+#include "load.h"
+
+/* read size for pipes and other non regular files */
+#define LOAD_BLOCK (1024 * 1024)
+
+static void
+load_stream(LoadBuf *lb, int fd)
+{
+    ssize_t n;
+
+    for (;;) {
+        if (lb->size - lb->len < LOAD_BLOCK) {
+            lb->size = lb->size? lb->size * 2: LOAD_BLOCK;
+            if (!(lb->data = realloc(lb->data, lb->size)))
+                die("load buf alloc err\n");
+        }
+
+        n = read(fd, &lb->data[lb->len], lb->size - lb->len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            die("read error: %s\n", strerror(errno));
+        }
+        if (!n) break;
+
+        lb->len += n;
+    }
+}
+
+/* path "-" means stdin. regular files are mapped,
+ * everything else is read in big blocks */
+void
+load_file(LoadBuf *lb, const char *path)
+{
+    struct stat st;
+    int         fd = 0;
+
+    lb->data   = NULL;
+    lb->len    = 0;
+    lb->size   = 0;
+    lb->mapped = 0;
+
+    if (strcmp(path, "-") && (fd = open(path, O_RDONLY)) < 0)
+        die("can't open %s: %s\n", path, strerror(errno));
+
+    if (fstat(fd, &st) < 0)
+        die("can't stat %s: %s\n", path, strerror(errno));
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        lb->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (lb->data == MAP_FAILED)
+            die("can't map %s: %s\n", path, strerror(errno));
+
+        madvise(lb->data, st.st_size, MADV_SEQUENTIAL);
+        lb->len    = st.st_size;
+        lb->size   = st.st_size;
+        lb->mapped = 1;
+    } else if (!S_ISREG(st.st_mode)) {
+        load_stream(lb, fd);
+    }
+
+    if (fd) close(fd);
+}
+
+/* append every line of the buffer without copying it */
+void
+load_lines(LoadBuf *lb, LineList *list)
+{
+    const char *p = lb->data, *end = lb->data + lb->len, *nl;
+
+    while (p < end) {
+        size_t len;
+
+        if (!(nl = memchr(p, '\n', end - p)))
+            nl = end;
+
+        len = nl - p;
+        if (len && p[len-1] == '\r')
+            len--;
+
+        linelist_append_ref(list, p, len);
+        p = nl + 1;
+    }
+}
+
+void
+load_free(LoadBuf *lb)
+{
+    if (lb->mapped)
+        munmap(lb->data, lb->size);
+    else
+        free(lb->data);
+}
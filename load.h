@@ -0,0 +1,16 @@
+#ifndef LOAD_H
+#define LOAD_H
+
+/* initial buffer contents, lines borrow their text from it */
+typedef struct {
+    char   *data;
+    size_t len;
+    size_t size;   /* bytes mapped or allocated */
+    int    mapped; /* 1 if data is an mmap      */
+} LoadBuf;
+
+void load_file(LoadBuf *lb, const char *path);
+void load_lines(LoadBuf *lb, LineList *list);
+void load_free(LoadBuf *lb);
+
+#endif
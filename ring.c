@@ -0,0 +1,50 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "ring.h"
+
+void
+ring_init(Ring *ring, size_t size)
+{
+    if (!(ring->buf = malloc(size)))
+        die("ring alloc err\n");
+
+    ring->size = size;
+    ring_clear(ring);
+}
+
+void
+ring_free(Ring *ring)
+{
+    free(ring->buf);
+    ring->buf = NULL;
+}
+
+void
+ring_clear(Ring *ring)
+{
+    ring->head = 0;
+    ring->len  = 0;
+}
+
+void
+ring_write(Ring *ring, const char *data, size_t n)
+{
+    size_t chunk;
+
+    /* only the tail of big writes survives anyway */
+    if (n > ring->size) {
+        data += n - ring->size;
+        n     = ring->size;
+    }
+
+    chunk = ring->size - ring->head;
+    if (chunk > n) chunk = n;
+
+    memcpy(&ring->buf[ring->head], data, chunk);
+    memcpy(ring->buf, data + chunk, n - chunk);
+
+    ring->head = (ring->head + n) % ring->size;
+    ring->len  = ring->len + n > ring->size? ring->size: ring->len + n;
+}
@@ -0,0 +1,26 @@
+#ifndef RING_H
+#define RING_H
+
+/* fixed size byte ring, keeps the newest size bytes */
+typedef struct {
+    char   *buf;
+    size_t size;
+    size_t head; /* next write position */
+    size_t len;  /* bytes stored        */
+} Ring;
+
+void ring_init(Ring *ring, size_t size);
+void ring_free(Ring *ring);
+void ring_clear(Ring *ring);
+void ring_write(Ring *ring, const char *data, size_t n);
+
+/* i-th stored byte, 0 is the oldest */
+static inline char
+ring_at(const Ring *ring, size_t i)
+{
+    size_t pos = ring->head + ring->size - ring->len + i;
+
+    return ring->buf[pos < ring->size? pos: pos - ring->size];
+}
+
+#endif
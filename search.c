@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "common.h"
+#include "linelist.h"
+#include "history.h"
+#include "search.h"
+
+/* where a running query takes its ids from */
+enum {
+    SRC_PREV, /* matches of the query it extends */
+    SRC_ALL   /* every entry                     */
+};
+
+#define LOWER(c)   ((unsigned char)tolower((unsigned char)(c)))
+#define CHARBIT(c) (1ULL << (LOWER(c) & 63))
+
+static void
+posting_add(Posting *p, uint32_t id)
+{
+    if (p->len == p->cap) {
+        p->cap = p->cap? p->cap * 2: 4;
+        if (!(p->ids = realloc(p->ids, p->cap * sizeof(uint32_t))))
+            die("search alloc err\n");
+    }
+
+    p->ids[p->len++] = id;
+}
+
+void
+search_init(Search *s)
+{
+    memset(s, 0, sizeof(*s));
+}
+
+void
+search_free(Search *s)
+{
+    free(s->chars);
+    free(s->matches.ids);
+    free(s->prev.ids);
+}
+
+/* make room for the entries added since the last call, search_step
+ * indexes them before it matches anything */
+void
+search_index(Search *s, History *h)
+{
+    if (h->count > s->cap) {
+        s->cap = h->count * 2;
+        if (!(s->chars = realloc(s->chars, s->cap * sizeof(uint64_t))))
+            die("search alloc err\n");
+    }
+
+    if (h->count > s->indexed)
+        s->valid = 0;
+}
+
+static void
+index_entry(Search *s, History *h, uint32_t id)
+{
+    const HistRec *rec;
+    const char    *text = history_entry(h, id, &rec);
+    uint64_t      chars = 0;
+    size_t        i;
+
+    s->chars[id] = 0;
+    if (!text) return;
+
+    for (i = 0; i < rec->len; i++)
+        chars |= CHARBIT(text[i]);
+    s->chars[id] = chars;
+}
+
+/* first c in p[0..n) ignoring case */
+static const char *
+find_ci(const char *p, size_t n, char c)
+{
+    char lo = tolower((unsigned char)c), up = toupper((unsigned char)c);
+
+#ifdef __SSE2__
+    __m128i vlo = _mm_set1_epi8(lo), vup = _mm_set1_epi8(up);
+
+    for (; n >= 16; p += 16, n -= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int     m = _mm_movemask_epi8(_mm_or_si128(
+                    _mm_cmpeq_epi8(v, vlo), _mm_cmpeq_epi8(v, vup)));
+
+        if (m) return p + __builtin_ctz(m);
+    }
+#endif
+
+    for (; n; p++, n--)
+        if (*p == lo || *p == up)
+            return p;
+
+    return NULL;
+}
+
+/* query chars (blanks skipped) must appear in order. runs of
+ * consecutive chars and chars starting a word score higher,
+ * -1 if there is no match */
+static int
+score(const char *text, size_t len, const char *q, size_t qn)
+{
+    const char *p = text, *end = text + len, *prev = NULL;
+    int        sc = 0;
+    size_t     i;
+
+    for (i = 0; i < qn; i++) {
+        const char *m;
+
+        if (q[i] == ' ') continue;
+        if (!(m = find_ci(p, end - p, q[i])))
+            return -1;
+
+        sc += 1;
+        if (prev && m == prev + 1)
+            sc += 4;
+        if (m == text || strchr(" \n/-_.|;&", m[-1]))
+            sc += 2;
+
+        prev = m;
+        p    = m + 1;
+    }
+
+    /* shorter entries first among equals */
+    return sc * 16 + 15 - (int)(len > 15 * 16? 15: len / 16);
+}
+
+static void
+top_add(Search *s, uint32_t id, int sc)
+{
+    size_t i;
+
+    if (s->ntop == SEARCH_TOP && sc <= s->top[SEARCH_TOP-1].score)
+        return;
+
+    /* ids come newest first, so ties keep that order */
+    i = s->ntop < SEARCH_TOP? s->ntop++: SEARCH_TOP - 1;
+    for (; i > 0 && s->top[i-1].score < sc; i--)
+        s->top[i] = s->top[i-1];
+
+    s->top[i].id    = id;
+    s->top[i].score = sc;
+}
+
+static void
+consider(Search *s, History *h, uint32_t id)
+{
+    const HistRec *rec;
+    const char    *text;
+    int           sc;
+
+    if (id >= h->count || (s->chars[id] & s->need) != s->need
+            || !(text = history_entry(h, id, &rec))
+            || (sc = score(text, rec->len, s->query, s->qlen)) < 0)
+        return;
+
+    posting_add(&s->matches, id);
+    top_add(s, id, sc);
+}
+
+/* start matching q. a query extending the last finished one only
+ * narrows its matches, anything else goes over every entry with the
+ * char sets ruling most of them out. the work is done by search_step.
+ * the chars of q must show up in order but not next to each other, so
+ * nothing short of that can be used to skip an entry */
+void
+search_query(Search *s, const char *q, size_t n)
+{
+    size_t i;
+
+    if (n > SEARCH_QUERY_MAX) n = SEARCH_QUERY_MAX;
+
+    free(s->prev.ids);
+    memset(&s->prev, 0, sizeof(s->prev));
+
+    if (s->valid && n >= s->qlen && !memcmp(q, s->query, s->qlen)) {
+        s->src  = SRC_PREV;
+        s->prev = s->matches;
+        s->ai   = 0;
+    } else {
+        free(s->matches.ids);
+        s->src  = SRC_ALL;
+        s->ai   = s->indexed;
+    }
+    memset(&s->matches, 0, sizeof(s->matches));
+
+    s->need = 0;
+    for (i = 0; i < n; i++)
+        if (q[i] != ' ') s->need |= CHARBIT(q[i]);
+
+    memcpy(s->query, q, n);
+    s->qlen    = n;
+    s->ntop    = 0;
+    s->valid   = 0;
+    s->running = 1;
+}
+
+/* next id of the running query, newest first. 0 when out of them */
+static int
+next_id(Search *s, uint32_t *id)
+{
+    if (s->src == SRC_PREV) {
+        if (s->ai == s->prev.len) return 0;
+        *id = s->prev.ids[s->ai++];
+        return 1;
+    }
+
+    if (!s->ai) return 0;
+    *id = --s->ai;
+    return 1;
+}
+
+/* index, then match until now_us passes deadline.
+ * 1 once the query is done */
+int
+search_step(Search *s, History *h, long long deadline)
+{
+    uint32_t id;
+    int      n = 0;
+
+    if (!s->running) return 1;
+
+    if (s->indexed < h->count && s->indexed < s->cap) {
+        char q[SEARCH_QUERY_MAX];
+
+        while (s->indexed < h->count && s->indexed < s->cap) {
+            index_entry(s, h, s->indexed++);
+            if (++n % 1024 == 0 && now_us() >= deadline)
+                return 0;
+        }
+
+        /* the query was set up for the old index */
+        memcpy(q, s->query, s->qlen);
+        search_query(s, q, s->qlen);
+    }
+
+    while (next_id(s, &id)) {
+        consider(s, h, id);
+
+        if (++n % 1024 == 0 && now_us() >= deadline)
+            return 0;
+    }
+
+    free(s->prev.ids);
+    memset(&s->prev, 0, sizeof(s->prev));
+    s->running = 0;
+    s->valid   = 1;
+
+    return 1;
+}
@@ -0,0 +1,47 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdint.h>
+
+#define SEARCH_QUERY_MAX 64
+#define SEARCH_TOP       256
+
+typedef struct {
+    uint32_t *ids;
+    uint32_t len;
+    uint32_t cap;
+} Posting;
+
+typedef struct {
+    uint32_t id;
+    int      score;
+} SearchHit;
+
+/* fuzzy search over history entries. entries are indexed by a bit
+ * set of the chars they hold, which only grows since the history is
+ * append only */
+typedef struct {
+    uint64_t  *chars;    /* per entry char bit set              */
+    size_t    indexed;   /* entries indexed so far              */
+    size_t    cap;
+    Posting   matches;   /* entries matching query, newest first */
+    char      query[SEARCH_QUERY_MAX];
+    size_t    qlen;
+    int       valid;     /* matches are complete for query      */
+    /* a query in progress goes through one of these, newest first */
+    int       running;
+    int       src;       /* SRC_* in search.c                   */
+    Posting   prev;      /* matches of the query it extends     */
+    size_t    ai;        /* position in prev or every entry     */
+    uint64_t  need;      /* chars the query holds               */
+    SearchHit top[SEARCH_TOP]; /* best matches, best first      */
+    size_t    ntop;
+} Search;
+
+void search_init(Search *s);
+void search_free(Search *s);
+void search_index(Search *s, History *h);
+void search_query(Search *s, const char *q, size_t n);
+int  search_step(Search *s, History *h, long long deadline);
+
+#endif
@@ -0,0 +1,198 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "linelist.h"
+#include "history.h"
+#include "search.h"
+
+/*
+ * history search has to give the same hits for a query however it was
+ * typed: fresh, one char at a time, or extending an earlier one. each
+ * is checked against a plain in order match over every entry
+ */
+
+#define TEST_ENTRIES 3000
+#define TEST_QUERIES 500
+
+static const char *g_fixed[] = {
+    "docker ps",
+    "docker run --rm -it alpine sh",
+    "git status",
+    "make install",
+    "ls -la /tmp",
+    "kubectl get pods -n kube-system",
+};
+
+static const char *g_words[] = {
+    "git", "docker", "make", "ls", "cd", "grep", "ssh", "tar", "rsync",
+    "kubectl", "-la", "-rf", "--all", "/tmp", "/var/log", "src", "build",
+    "status", "commit", "push", "pull", "install", "ps", "run", "logs",
+};
+
+static char g_dir[] = "/tmp/ice_test.XXXXXX";
+
+static unsigned long g_seed = 1;
+
+static size_t
+rnd(size_t n)
+{
+    g_seed = g_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (g_seed >> 33) % n;
+}
+
+/* what score accepts: the query chars, blanks skipped, in order */
+static int
+naive(const char *text, size_t len, const char *q, size_t qn)
+{
+    size_t i, j = 0;
+
+    for (i = 0; i < qn; i++) {
+        if (q[i] == ' ') continue;
+        while (j < len && tolower((unsigned char)text[j])
+                != tolower((unsigned char)q[i]))
+            j++;
+        if (j++ == len) return 0;
+    }
+
+    return 1;
+}
+
+static int
+cmp_id(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* the hits of q as a sorted copy, n in *len */
+static uint32_t *
+hits(Search *s, History *h, const char *q, size_t n, size_t *len)
+{
+    uint32_t *ids;
+
+    search_query(s, q, n);
+    while (!search_step(s, h, now_us() + 1000000));
+
+    *len = s->matches.len;
+    if (!(ids = malloc((*len + 1) * sizeof(uint32_t))))
+        die("test alloc err\n");
+    memcpy(ids, s->matches.ids, *len * sizeof(uint32_t));
+    qsort(ids, *len, sizeof(uint32_t), cmp_id);
+
+    return ids;
+}
+
+static void
+check(History *h, const char *q)
+{
+    Search   fresh, typed;
+    uint32_t *a, *b, *want;
+    size_t   na, nb, nwant = 0, n = strlen(q), i;
+
+    if (!(want = malloc((h->count + 1) * sizeof(uint32_t))))
+        die("test alloc err\n");
+    for (i = 0; i < h->count; i++) {
+        const HistRec *rec;
+        const char    *text = history_entry(h, i, &rec);
+
+        if (text && naive(text, rec->len, q, n))
+            want[nwant++] = i;
+    }
+
+    search_init(&fresh);
+    search_index(&fresh, h);
+    a = hits(&fresh, h, q, n, &na);
+
+    search_init(&typed);
+    search_index(&typed, h);
+    for (i = 1; i < n; i++)
+        free(hits(&typed, h, q, i, &nb));
+    b = hits(&typed, h, q, n, &nb);
+
+    if (na != nwant || memcmp(a, want, na * sizeof(uint32_t)))
+        die("query '%s': %zu fresh hits, %zu expected\n", q, na, nwant);
+    if (nb != nwant || memcmp(b, want, nb * sizeof(uint32_t)))
+        die("query '%s': %zu typed hits, %zu expected\n", q, nb, nwant);
+
+    free(a);
+    free(b);
+    free(want);
+    search_free(&fresh);
+    search_free(&typed);
+}
+
+static void
+cleanup(void)
+{
+    char path[sizeof(g_dir) + 32];
+
+    snprintf(path, sizeof(path), "%s/history", g_dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/history.idx", g_dir);
+    unlink(path);
+    rmdir(g_dir);
+}
+
+int
+main(void)
+{
+    static const char *queries[] = {
+        "dkr", "dock", "docker ps", "gst", "mk ins", "ls l", "kgp", "d p",
+    };
+    History  h = {0};
+    LineList *list;
+    char     path[sizeof(g_dir) + 32], line[256], q[8];
+    size_t   i, j, n;
+
+    if (!mkdtemp(g_dir))
+        die("can't create %s: %s\n", g_dir, strerror(errno));
+    atexit(cleanup);
+
+    snprintf(path, sizeof(path), "%s/history", g_dir);
+    history_init(&h, path);
+
+    for (i = 0; i < TEST_ENTRIES; i++) {
+        if (i < sizeof(g_fixed) / sizeof(*g_fixed)) {
+            snprintf(line, sizeof(line), "%s", g_fixed[i]);
+        } else {
+            for (j = 0, n = 0, line[0] = 0; j < 2 + rnd(4); j++)
+                n += snprintf(&line[n], sizeof(line) - n, "%s%s",
+                        j? " ": "", g_words[rnd(sizeof(g_words)
+                                / sizeof(*g_words))]);
+        }
+
+        list = linelist_create();
+        linelist_append(list, line);
+        if (history_add(&h, list->head, NULL) < 0)
+            die("can't add to %s\n", path);
+        linelist_free(list);
+    }
+    history_map(&h);
+
+    for (i = 0; i < sizeof(queries) / sizeof(*queries); i++)
+        check(&h, queries[i]);
+
+    /* random queries from the chars the entries use */
+    for (i = 0; i < TEST_QUERIES; i++) {
+        const char *w = g_words[rnd(sizeof(g_words) / sizeof(*g_words))];
+
+        for (j = 0, n = 1 + rnd(5); j < n; j++)
+            q[j] = rnd(6)? w[rnd(strlen(w))]: ' ';
+        q[n] = 0;
+        check(&h, q);
+    }
+
+    history_free(&h);
+    printf("search: %zu queries ok\n",
+            sizeof(queries) / sizeof(*queries) + (size_t)TEST_QUERIES);
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "common.h"
+#include "shell.h"
+
+#define SHELL_MAX_ARGS 32
+
+extern char **environ;
+
+static int
+pipe_cloexec(int fds[2])
+{
+    if (pipe(fds) < 0)
+        return -1;
+
+    /* only the dup2'ed copies may reach the child */
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+/* run cmd (split on blanks) with arg appended, without a /bin/sh -c in
+ * between. posix_spawn doesn't copy our page tables like fork does */
+int
+shell_spawn(Shell *sh, const char *cmd, const char *arg, int flags)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t          attr;
+    sigset_t                   sigs;
+    char  words[256], *argv[SHELL_MAX_ARGS+2], *w;
+    int   in[2] = { -1, -1 }, out[2] = { -1, -1 };
+    int   argc = 0, rv;
+
+    sh->pid = -1;
+    sh->in  = -1;
+    sh->out = -1;
+
+    strncpy(words, cmd, sizeof(words)-1);
+    words[sizeof(words)-1] = 0;
+    for (w = strtok(words, " \t"); w && argc < SHELL_MAX_ARGS;
+            w = strtok(NULL, " \t"))
+        argv[argc++] = w;
+    if (arg)
+        argv[argc++] = (char *)arg;
+    argv[argc] = NULL;
+
+    if (!argc)
+        return -1;
+
+    if ((flags & SHELL_STDIN) && pipe_cloexec(in) < 0)
+        return -1;
+    if ((flags & SHELL_CAPTURE) && pipe_cloexec(out) < 0)
+        goto err;
+
+    posix_spawn_file_actions_init(&fa);
+    if (flags & SHELL_STDIN)
+        posix_spawn_file_actions_adddup2(&fa, in[0], STDIN_FILENO);
+    if (flags & SHELL_CAPTURE) {
+        posix_spawn_file_actions_adddup2(&fa, out[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&fa, out[1], STDERR_FILENO);
+    }
+
+    /* we ignore SIGPIPE, pipelines in the child must not */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGPIPE);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigdefault(&attr, &sigs);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+    rv = posix_spawnp(&sh->pid, argv[0], &fa, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+
+    if (rv) {
+        errno = rv;
+        goto err;
+    }
+
+    if (flags & SHELL_STDIN) {
+        close(in[0]);
+        sh->in = in[1];
+    }
+    if (flags & SHELL_CAPTURE) {
+        close(out[1]);
+        sh->out = out[0];
+    }
+
+    return 0;
+
+err:
+    if (in[0] >= 0)  { close(in[0]);  close(in[1]);  }
+    if (out[0] >= 0) { close(out[0]); close(out[1]); }
+    return -1;
+}
+
+/* close our ends of the pipes, the child keeps running */
+void
+shell_close(Shell *sh)
+{
+    if (sh->in >= 0)  close(sh->in);
+    if (sh->out >= 0) close(sh->out);
+    sh->in = sh->out = -1;
+}
+
+/* reap the child if it has exited, without waiting for it.
+ * returns 1 and its wait status in *status once it's gone */
+int
+shell_reap(Shell *sh, int *status, struct rusage *usage)
+{
+    pid_t rv;
+
+    *status = -1;
+    if (sh->pid < 0)
+        return 1;
+
+    while ((rv = wait4(sh->pid, status, WNOHANG, usage)) < 0
+            && errno == EINTR);
+    if (!rv)
+        return 0;
+
+    sh->pid = -1;
+    return 1;
+}
+
+/* close our ends of the pipes and reap the child,
+ * returns its wait status like pclose does */
+int
+shell_wait(Shell *sh, struct rusage *usage)
+{
+    int status = -1;
+
+    shell_close(sh);
+
+    if (sh->pid < 0)
+        return -1;
+
+    while (wait4(sh->pid, &status, 0, usage) < 0)
+        if (errno != EINTR)
+            return -1;
+
+    sh->pid = -1;
+    return status;
+}
@@ -0,0 +1,25 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#include <sys/types.h>
+
+struct rusage;
+
+/* shell_spawn flags */
+enum {
+    SHELL_STDIN   = 1 << 0, /* pipe for the child's stdin        */
+    SHELL_CAPTURE = 1 << 1  /* pipe for its stdout and stderr    */
+};
+
+typedef struct {
+    pid_t pid;
+    int   in;  /* child's stdin, -1 if not piped         */
+    int   out; /* child's stdout+stderr, -1 if inherited */
+} Shell;
+
+int  shell_spawn(Shell *sh, const char *cmd, const char *arg, int flags);
+void shell_close(Shell *sh);
+int  shell_reap(Shell *sh, int *status, struct rusage *usage);
+int  shell_wait(Shell *sh, struct rusage *usage);
+
+#endif
@@ -248,6 +248,8 @@ extern "C" {
 #define TB_HARDCAP_STRIKEOUT    "\x1b[9m"
 #define TB_HARDCAP_UNDERLINE_2  "\x1b[21m"
 #define TB_HARDCAP_OVERLINE     "\x1b[53m"
+#define TB_HARDCAP_SYNC_BEGIN   "\x1b[?2026h"
+#define TB_HARDCAP_SYNC_END     "\x1b[?2026l"
 
 /* Colors (numeric) and attributes (bitwise) (`tb_cell.fg`, `tb_cell.bg`) */
 #define TB_DEFAULT              0x0000
@@ -490,6 +492,19 @@ int tb_present(void);
  */
 int tb_invalidate(void);
 
+/* Scroll rows `top` up to `bottom` (exclusive) of the terminal up by `n`
+ * rows, or down for negative `n`, and shift the front buffer the same way.
+ * The next `tb_present` then only sends the rows the scroll exposed. The back
+ * buffer is left as it is. Scrolls by the region height or more do nothing.
+ */
+int tb_scroll(int top, int bottom, int n);
+
+/* Wrap the output of each `tb_present` in synchronized update mode (DEC
+ * private mode 2026), so the terminal shows a frame at once instead of while
+ * it arrives. Only turn this on for terminals that report the mode.
+ */
+int tb_set_sync_output(int on);
+
 /* Set the position of the cursor. Upper-left cell is (0, 0). */
 int tb_set_cursor(int cx, int cy);
 int tb_hide_cursor(void);
@@ -797,6 +812,7 @@ struct cellbuf {
     int width;
     int height;
     struct tb_cell *cells;
+    unsigned char *dirty; // per row, set when the row may differ from front
 };
 
 struct cap_trie {
@@ -838,6 +854,7 @@ struct tb_global {
     int has_orig_tios;
     int last_errno;
     int initialized;
+    int sync_output;
     int (*fn_extract_esc_pre)(struct tb_event *, size_t *);
     int (*fn_extract_esc_post)(struct tb_event *, size_t *);
     char errbuf[1024];
@@ -2307,6 +2324,7 @@ static int send_attr(uintattr_t fg, uintattr_t bg);
 static int send_sgr(uint32_t fg, uint32_t bg, int fg_is_default,
     int bg_is_default);
 static int send_cursor_if(int x, int y);
+static int send_move(int x, int y);
 static int send_char(int x, int y, uint32_t ch);
 static int send_cluster(int x, int y, uint32_t *ch, size_t nch);
 static int convert_num(uint32_t num, char *buf);
@@ -2322,10 +2340,12 @@ static int cellbuf_clear(struct cellbuf *c);
 static int cellbuf_get(struct cellbuf *c, int x, int y, struct tb_cell **out);
 static int cellbuf_in_bounds(struct cellbuf *c, int x, int y);
 static int cellbuf_resize(struct cellbuf *c, int w, int h);
+static int cellbuf_row_equal(struct cellbuf *a, struct cellbuf *b, int y);
 static int bytebuf_puts(struct bytebuf *b, const char *str);
 static int bytebuf_nputs(struct bytebuf *b, const char *str, size_t nstr);
 static int bytebuf_shift(struct bytebuf *b, size_t n);
 static int bytebuf_flush(struct bytebuf *b, int fd);
+static int bytebuf_prepend(struct bytebuf *b, const char *str);
 static int bytebuf_reserve(struct bytebuf *b, size_t sz);
 static int bytebuf_free(struct bytebuf *b);
 static int tb_iswprint_ex(uint32_t ch, int *width);
@@ -2413,12 +2433,22 @@ int tb_present(void) {
     global.last_x = -1;
     global.last_y = -1;
 
+    size_t frame_start = global.out.len;
+
     int x, y, i;
     for (y = 0; y < global.front.height; y++) {
+        // Rows nobody wrote to since the last present are still in sync, and
+        // rows that were redrawn with the same content compare equal as a
+        // whole. Either way there is nothing to send.
+        if (!global.back.dirty[y]) continue;
+        global.back.dirty[y] = 0;
+        if (cellbuf_row_equal(&global.back, &global.front, y)) continue;
+
+        struct tb_cell *back_row = &global.back.cells[y * global.back.width];
+        struct tb_cell *front_row =
+            &global.front.cells[y * global.front.width];
         for (x = 0; x < global.front.width;) {
-            struct tb_cell *back, *front;
-            if_err_return(rv, cellbuf_get(&global.back, x, y, &back));
-            if_err_return(rv, cellbuf_get(&global.front, x, y, &front));
+            struct tb_cell *back = &back_row[x], *front = &front_row[x];
 
             int w;
             {
@@ -2457,20 +2487,30 @@ int tb_present(void) {
                     // we'll get a cell_cmp diff for the skipped cells and
                     // properly re-render.
                     for (i = 1; i < w; i++) {
-                        struct tb_cell *front_wide;
                         uint32_t invalid = -1;
                         if_err_return(rv,
-                            cellbuf_get(&global.front, x + i, y, &front_wide));
-                        if_err_return(rv,
-                            cell_set(front_wide, &invalid, 1, -1, -1));
+                            cell_set(&front_row[x + i], &invalid, 1, -1, -1));
                     }
+
+                    // Terminals don't agree on the width of every wide char,
+                    // so don't move relative to one
+                    if (w > 1) global.last_y = -1;
                 }
             }
             x += w;
         }
     }
 
+    // Without changed cells the cursor is still where it was put
+    if (global.out.len == frame_start) {
+        return bytebuf_flush(&global.out, global.wfd);
+    }
+
     if_err_return(rv, send_cursor_if(global.cursor_x, global.cursor_y));
+    if (global.sync_output) {
+        if_err_return(rv, bytebuf_prepend(&global.out, TB_HARDCAP_SYNC_BEGIN));
+        if_err_return(rv, bytebuf_puts(&global.out, TB_HARDCAP_SYNC_END));
+    }
     if_err_return(rv, bytebuf_flush(&global.out, global.wfd));
 
     return TB_OK;
@@ -2483,6 +2523,64 @@ int tb_invalidate(void) {
     return TB_OK;
 }
 
+int tb_scroll(int top, int bottom, int n) {
+    if_not_init_return();
+    int rv, x, y, i;
+    char nbuf[32];
+    uint32_t space = (uint32_t)' ';
+    struct cellbuf *c = &global.front;
+
+    if (top < 0 || bottom > c->height || top >= bottom) {
+        return TB_ERR_OUT_OF_BOUNDS;
+    }
+    if (n == 0 || n >= bottom - top || -n >= bottom - top) {
+        return TB_OK;
+    }
+
+    // Erased rows take the current background, make it the clear one
+    if_err_return(rv, send_attr(global.fg, global.bg));
+    send_literal(rv, "\x1b[");
+    send_num(rv, nbuf, top + 1);
+    send_literal(rv, ";");
+    send_num(rv, nbuf, bottom);
+    send_literal(rv, "r");
+    if (n > 0) {
+        if_err_return(rv, send_cursor_if(0, bottom - 1));
+        for (i = 0; i < n; i++) send_literal(rv, "\n");
+    } else {
+        if_err_return(rv, send_cursor_if(0, top));
+        for (i = 0; i < -n; i++) send_literal(rv, "\x1bM");
+    }
+    send_literal(rv, "\x1b[r");
+    if_err_return(rv, send_cursor_if(global.cursor_x, global.cursor_y));
+    global.last_x = -1;
+    global.last_y = -1;
+
+    for (i = 0; i < bottom - top; i++) {
+        y = n > 0 ? top + i : bottom - 1 - i;
+        int from = y + n;
+        for (x = 0; x < c->width; x++) {
+            struct tb_cell *dst = &c->cells[y * c->width + x];
+            if (from >= top && from < bottom) {
+                if_err_return(rv,
+                    cell_copy(dst, &c->cells[from * c->width + x]));
+            } else {
+                if_err_return(rv,
+                    cell_set(dst, &space, 1, global.fg, global.bg));
+            }
+        }
+        global.back.dirty[y] = 1;
+    }
+
+    return TB_OK;
+}
+
+int tb_set_sync_output(int on) {
+    if_not_init_return();
+    global.sync_output = on;
+    return TB_OK;
+}
+
 int tb_set_cursor(int cx, int cy) {
     if_not_init_return();
     int rv;
@@ -2521,12 +2619,17 @@ int tb_set_cell_ex(int x, int y, uint32_t *ch, size_t nch, uintattr_t fg,
     struct tb_cell *cell;
     if_err_return(rv, cellbuf_get(&global.back, x, y, &cell));
     if_err_return(rv, cell_set(cell, ch, nch, fg, bg));
+    global.back.dirty[y] = 1;
     return TB_OK;
 }
 
 int tb_get_cell(int x, int y, int back, struct tb_cell **cell) {
     if_not_init_return();
-    return cellbuf_get(back ? &global.back : &global.front, x, y, cell);
+    int rv;
+    if_err_return(rv,
+        cellbuf_get(back ? &global.back : &global.front, x, y, cell));
+    if (back) global.back.dirty[y] = 1; // caller may write through it
+    return TB_OK;
 }
 
 int tb_extend_cell(int x, int y, uint32_t ch) {
@@ -2537,6 +2640,7 @@ int tb_extend_cell(int x, int y, uint32_t ch) {
     struct tb_cell *cell;
     size_t nech;
     if_err_return(rv, cellbuf_get(&global.back, x, y, &cell));
+    global.back.dirty[y] = 1;
     if (cell->nech > 0) { // append to ech
         nech = cell->nech + 1;
         if_err_return(rv, cell_reserve_ech(cell, nech + 1));
@@ -3764,6 +3868,7 @@ static int resize_cellbufs(void) {
     if_err_return(rv,
         cellbuf_resize(&global.front, global.width, global.height));
     if_err_return(rv, cellbuf_clear(&global.front));
+    memset(global.back.dirty, 1, (size_t)global.back.height);
     if_err_return(rv, send_clear());
     return TB_OK;
 }
@@ -3973,6 +4078,81 @@ static int send_cursor_if(int x, int y) {
     return TB_OK;
 }
 
+// Write a CSI sequence to buf with its one parameter left out when it's the
+// default of 1. Returns the length.
+static int csi_num(char *buf, int n, char final) {
+    int len = 2;
+    buf[0] = '\x1b';
+    buf[1] = '[';
+    if (n != 1) len += convert_num((uint32_t)n, buf + len);
+    buf[len++] = final;
+    return len;
+}
+
+// Move the cursor to x,y ahead of a write. From a known position a relative
+// motion is often shorter than an absolute one, and on the same row a few
+// unchanged cells can be written again for less than any motion.
+static int send_move(int x, int y) {
+    int rv, i;
+    int cx = global.last_x + 1, cy = global.last_y;
+    int dx = x - cx, dy = y - cy;
+    char v[16], h[16], alt[16], nbuf[32];
+    int nv = 0, nh = 0, nalt, ncup;
+
+    // The position is unknown after a wide char, and ambiguous in the pending
+    // wrap state after the last column
+    if (cy < 0 || cx >= global.width) {
+        return send_cursor_if(x, y);
+    }
+
+    if (dy > 0 && dy <= 3) {
+        for (; nv < dy; nv++) v[nv] = '\n';
+    } else if (dy > 0) {
+        nv = csi_num(v, dy, 'B');
+    } else if (dy < 0) {
+        nv = csi_num(v, -dy, 'A');
+    }
+
+    if (x == 0 && dx) {
+        h[0] = '\r';
+        nh = 1;
+    } else if (dx == -1) {
+        h[0] = '\b';
+        nh = 1;
+    } else if (dx) {
+        nh = csi_num(h, x + 1, 'G');
+        nalt = csi_num(alt, dx > 0 ? dx : -dx, dx > 0 ? 'C' : 'D');
+        if (nalt < nh) {
+            memcpy(h, alt, (size_t)nalt);
+            nh = nalt;
+        }
+    }
+
+    if (dy == 0 && dx > 0 && dx <= nh) {
+        struct tb_cell *gap = &global.front.cells[y * global.front.width + cx];
+        for (i = 0; i < dx; i++) {
+            if (gap[i].ch < 0x20 || gap[i].ch > 0x7e ||
+                gap[i].fg != global.last_fg || gap[i].bg != global.last_bg)
+                break;
+#ifdef TB_OPT_EGC
+            if (gap[i].nech > 0) break;
+#endif
+            h[i] = (char)gap[i].ch;
+        }
+        if (i == dx) nh = dx;
+    }
+
+    ncup = 4 + convert_num((uint32_t)y + 1, nbuf) +
+           convert_num((uint32_t)x + 1, nbuf);
+    if (nv + nh >= ncup) {
+        return send_cursor_if(x, y);
+    }
+
+    if_err_return(rv, bytebuf_nputs(&global.out, v, (size_t)nv));
+    if_err_return(rv, bytebuf_nputs(&global.out, h, (size_t)nh));
+    return TB_OK;
+}
+
 static int send_char(int x, int y, uint32_t ch) {
     return send_cluster(x, y, &ch, 1);
 }
@@ -3982,7 +4162,7 @@ static int send_cluster(int x, int y, uint32_t *ch, size_t nch) {
     char chu8[8];
 
     if (global.last_x != x - 1 || global.last_y != y) {
-        if_err_return(rv, send_cursor_if(x, y));
+        if_err_return(rv, send_move(x, y));
     }
     global.last_x = x;
     global.last_y = y;
@@ -4087,6 +4267,13 @@ static int cellbuf_init(struct cellbuf *c, int w, int h) {
     c->cells = (struct tb_cell *)tb_malloc(sizeof(struct tb_cell) * w * h);
     if (!c->cells) return TB_ERR_MEM;
     memset(c->cells, 0, sizeof(struct tb_cell) * w * h);
+    c->dirty = (unsigned char *)tb_malloc((size_t)h);
+    if (!c->dirty) {
+        tb_free(c->cells);
+        c->cells = NULL;
+        return TB_ERR_MEM;
+    }
+    memset(c->dirty, 1, (size_t)h);
     c->width = w;
     c->height = h;
     return TB_OK;
@@ -4100,6 +4287,7 @@ static int cellbuf_free(struct cellbuf *c) {
         }
         tb_free(c->cells);
     }
+    if (c->dirty) tb_free(c->dirty);
     memset(c, 0, sizeof(*c));
     return TB_OK;
 }
@@ -4111,6 +4299,7 @@ static int cellbuf_clear(struct cellbuf *c) {
         if_err_return(rv,
             cell_set(&c->cells[i], &space, 1, global.fg, global.bg));
     }
+    memset(c->dirty, 1, (size_t)c->height);
     return TB_OK;
 }
 
@@ -4148,8 +4337,10 @@ static int cellbuf_resize(struct cellbuf *c, int w, int h) {
     int minh = (h < oh) ? h : oh;
 
     struct tb_cell *prev = c->cells;
+    unsigned char *prev_dirty = c->dirty;
 
     if_err_return(rv, cellbuf_init(c, w, h));
+    if (prev_dirty) tb_free(prev_dirty);
     if_err_return(rv, cellbuf_clear(c));
 
     int x, y;
@@ -4167,6 +4358,23 @@ static int cellbuf_resize(struct cellbuf *c, int w, int h) {
     return TB_OK;
 }
 
+static int cellbuf_row_equal(struct cellbuf *a, struct cellbuf *b, int y) {
+    struct tb_cell *ra = &a->cells[y * a->width];
+    struct tb_cell *rb = &b->cells[y * b->width];
+    int x;
+#if !defined TB_OPT_EGC
+    // Without clusters a cell is plain data. Unless the attribute width
+    // leaves padding in it, one memcmp covers the row.
+    if (sizeof(struct tb_cell) == sizeof(ra->ch) + 2 * sizeof(ra->fg)) {
+        return !memcmp(ra, rb, sizeof(struct tb_cell) * (size_t)a->width);
+    }
+#endif
+    for (x = 0; x < a->width; x++) {
+        if (cell_cmp(&ra[x], &rb[x]) != 0) return 0;
+    }
+    return 1;
+}
+
 static int bytebuf_puts(struct bytebuf *b, const char *str) {
     if (!str || strlen(str) <= 0) return TB_OK; // Nothing to do for empty caps
     return bytebuf_nputs(b, str, (size_t)strlen(str));
@@ -4201,6 +4409,17 @@ static int bytebuf_flush(struct bytebuf *b, int fd) {
     return TB_OK;
 }
 
+static int bytebuf_prepend(struct bytebuf *b, const char *str) {
+    int rv;
+    size_t nstr = strlen(str);
+    if_err_return(rv, bytebuf_reserve(b, b->len + nstr + 1));
+    memmove(b->buf + nstr, b->buf, b->len);
+    memcpy(b->buf, str, nstr);
+    b->len += nstr;
+    b->buf[b->len] = '\0';
+    return TB_OK;
+}
+
 static int bytebuf_reserve(struct bytebuf *b, size_t sz) {
     if (b->cap >= sz) return TB_OK;
 
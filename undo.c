@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "undo.h"
+
+/* record header, the text follows it */
+typedef struct {
+    size_t size; /* whole record, padded          */
+    size_t prev; /* size of the one before, 0 if none */
+    size_t line;
+    size_t col;
+    size_t len;
+    int    type;
+    char   *ext; /* text if it was spilled, NULL if it follows */
+} Rec;
+
+#define REC_ALIGN      (sizeof(size_t) * 2)
+#define REC_SIZE(len)  ((sizeof(Rec) + (len) + REC_ALIGN - 1) \
+                        & ~(REC_ALIGN - 1))
+#define REC_AT(log, o) ((Rec *)&(log)->buf[o])
+#define REC_TEXT(rec)  ((rec)->ext? (rec)->ext: (char *)(rec) + sizeof(Rec))
+
+/* text this long goes to its own allocation, so one big paste doesn't
+ * push the whole history out of buf */
+#define SPILL(log, n)  ((n) > (log)->max / 4)
+
+void
+undo_init(UndoLog *log, size_t max)
+{
+    log->buf  = NULL;
+    log->cap  = 0;
+    log->max  = max;
+    log->len  = 0;
+    log->pos  = 0;
+    log->last = 0;
+    log->ext  = 0;
+}
+
+/* free the spilled text of the records from..to */
+static void
+free_ext(UndoLog *log, size_t from, size_t to)
+{
+    while (from < to) {
+        Rec *rec = REC_AT(log, from);
+
+        if (rec->ext) {
+            log->ext -= rec->len;
+            free(rec->ext);
+        }
+        from += rec->size;
+    }
+}
+
+void
+undo_free(UndoLog *log)
+{
+    free_ext(log, 0, log->len);
+    free(log->buf);
+    log->buf = NULL;
+}
+
+/* make room for n more bytes at pos plus ext spilled ones, dropping
+ * the oldest records if buf or the spilled text would outgrow max.
+ * spilled text bigger than max is still kept, as the only one */
+static int
+reserve(UndoLog *log, size_t n, size_t ext)
+{
+    size_t drop = 0, dropped = 0;
+
+    if (n > log->max) {
+        free_ext(log, 0, log->len);
+        log->len = log->pos = log->last = 0;
+        return 0;
+    }
+
+    while (drop < log->pos && (log->pos + n - drop > log->max
+                || (log->ext > dropped
+                    && log->ext + ext - dropped > log->max))) {
+        Rec *rec = REC_AT(log, drop);
+
+        if (rec->ext) dropped += rec->len;
+        drop += rec->size;
+    }
+
+    if (drop) {
+        free_ext(log, 0, drop);
+        memmove(log->buf, &log->buf[drop], log->pos - drop);
+        log->pos -= drop;
+        log->len  = log->pos;
+        if (!log->pos)
+            log->last = 0;
+        else
+            REC_AT(log, 0)->prev = 0;
+    }
+
+    if (log->pos + n > log->cap) {
+        size_t cap = log->cap? log->cap: 4096;
+
+        while (cap < log->pos + n) cap *= 2;
+        if (cap > log->max) cap = log->max;
+
+        if (!(log->buf = realloc(log->buf, cap)))
+            die("undo log alloc err\n");
+        log->cap = cap;
+    }
+
+    return 1;
+}
+
+/* extend the last record when typing or backspacing goes on where
+ * it stopped. words are kept apart so undo doesn't eat a whole line */
+static int
+coalesce(UndoLog *log, int type, size_t line, size_t col,
+        const char *text, size_t n)
+{
+    Rec    *rec;
+    char   *rt;
+    size_t size;
+
+    if (!log->last || memchr(text, '\n', n))
+        return 0;
+
+    rec = REC_AT(log, log->pos - log->last);
+    rt  = REC_TEXT(rec);
+
+    if (rec->type != type || rec->line != line || rec->ext
+            || memchr(rt, '\n', rec->len))
+        return 0;
+
+    if (type == UNDO_INSERT && (rec->col + rec->len != col
+                || (text[0] == ' ' && rt[rec->len-1] != ' ')))
+        return 0;
+    if (type == UNDO_DELETE && (col + n != rec->col
+                || (text[n-1] == ' ' && rt[0] != ' ')))
+        return 0;
+
+    if (SPILL(log, rec->len + n))
+        return 0;
+
+    size = REC_SIZE(rec->len + n);
+    if (size > log->last) {
+        /* reserve may move the log or drop this very record */
+        if (!reserve(log, size - log->last, 0) || !log->last)
+            return 0;
+        rec = REC_AT(log, log->pos - log->last);
+        rt  = REC_TEXT(rec);
+    }
+
+    if (type == UNDO_INSERT) {
+        memcpy(&rt[rec->len], text, n);
+    } else {
+        memmove(&rt[n], rt, rec->len);
+        memcpy(rt, text, n);
+        rec->col = col;
+    }
+
+    rec->len  += n;
+    rec->size  = size;
+    log->pos  += size - log->last;
+    log->len   = log->pos;
+    log->last  = size;
+
+    return 1;
+}
+
+/* add an edit that was just made, forgetting what could be redone */
+void
+undo_record(UndoLog *log, int type, size_t line, size_t col,
+        const char *text, size_t n)
+{
+    size_t size, ext;
+    Rec    *rec;
+
+    if (!n) return;
+
+    free_ext(log, log->pos, log->len);
+    log->len = log->pos;
+    if (coalesce(log, type, line, col, text, n))
+        return;
+
+    ext  = SPILL(log, n)? n: 0;
+    size = REC_SIZE(ext? 0: n);
+    if (!reserve(log, size, ext))
+        return;
+
+    rec       = REC_AT(log, log->pos);
+    rec->size = size;
+    rec->prev = log->last;
+    rec->line = line;
+    rec->col  = col;
+    rec->len  = n;
+    rec->type = type;
+    rec->ext  = NULL;
+    if (ext) {
+        if (!(rec->ext = malloc(n)))
+            die("undo log alloc err\n");
+        log->ext += n;
+    }
+    memcpy(REC_TEXT(rec), text, n);
+
+    log->pos += size;
+    log->len  = log->pos;
+    log->last = size;
+}
+
+static void
+rec_op(Rec *rec, int type, UndoOp *op)
+{
+    op->type = type;
+    op->line = rec->line;
+    op->col  = rec->col;
+    op->len  = rec->len;
+    op->text = REC_TEXT(rec);
+}
+
+/* the edit reverting the last one, 0 if there is none.
+ * op->text is valid until the next record */
+int
+undo_undo(UndoLog *log, UndoOp *op)
+{
+    Rec *rec;
+
+    if (!log->pos) return 0;
+
+    rec = REC_AT(log, log->pos - log->last);
+    rec_op(rec, rec->type == UNDO_INSERT? UNDO_DELETE: UNDO_INSERT, op);
+
+    log->pos -= log->last;
+    log->last = rec->prev;
+
+    return 1;
+}
+
+/* the last undone edit again, 0 if there is none */
+int
+undo_redo(UndoLog *log, UndoOp *op)
+{
+    Rec *rec;
+
+    if (log->pos == log->len) return 0;
+
+    rec = REC_AT(log, log->pos);
+    rec_op(rec, rec->type, op);
+
+    log->pos += rec->size;
+    log->last = rec->size;
+
+    return 1;
+}
@@ -0,0 +1,39 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+/* UndoOp types */
+enum {
+    UNDO_INSERT,
+    UNDO_DELETE
+};
+
+/* an edit: text inserted at or deleted from line, col.
+ * text may hold newlines */
+typedef struct {
+    int        type;
+    size_t     line;
+    size_t     col;
+    size_t     len;
+    const char *text;
+} UndoOp;
+
+/* edits as records in one buffer, oldest first. the records before
+ * pos can be undone, the ones from pos to len redone */
+typedef struct {
+    char   *buf;
+    size_t cap;
+    size_t max;  /* oldest records are dropped past this */
+    size_t len;
+    size_t pos;
+    size_t last; /* size of the record ending at pos */
+    size_t ext;  /* bytes of text spilled out of buf */
+} UndoLog;
+
+void undo_init(UndoLog *log, size_t max);
+void undo_free(UndoLog *log);
+void undo_record(UndoLog *log, int type, size_t line, size_t col,
+                 const char *text, size_t n);
+int  undo_undo(UndoLog *log, UndoOp *op);
+int  undo_redo(UndoLog *log, UndoOp *op);
+
+#endif